@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "include/cloth.h"
+#include "include/driver.h"
+
+#define TIME_STEP 0.01
+
+using namespace std;
+
+struct BenchmarkResult
+{
+    string name;
+    string kernel;
+    int resolution;
+    int masses;
+    int springs;
+    int threads;
+    int calls;
+    double median_ns;
+    double min_ns;
+};
+
+vector<int> parse_list(const char *text)
+{
+    vector<int> values;
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ','))
+    {
+        values.push_back(atoi(item.c_str()));
+    }
+    return values;
+}
+
+// A cloth with every spring a little off its rest length, so forces and constraints have work to do
+void crumple(Cloth &cloth)
+{
+    for (int i = 0; i < cloth.masses.size(); i++)
+    {
+        glm::dvec3 &p = cloth.masses.position[i];
+        p += glm::dvec3(0.05 * std::sin(3.0 * i), 0.3 * std::sin(0.7 * p.x) * std::cos(1.3 * p.z), 0.05 * std::cos(5.0 * i));
+    }
+    cloth.masses.last_position = cloth.masses.position;
+    cloth.compute_normal();
+}
+
+// Put the crumpled masses back along with the state a step carries over, so every call steps from the same state
+void restore_cloth(Cloth &cloth, const Masses &initial, double rk45_delta_t)
+{
+    cloth.wake_all();
+    fill(cloth.tile_still_time.begin(), cloth.tile_still_time.end(), 0.0);
+    cloth.masses = initial;
+    cloth.rk45_delta_t = rk45_delta_t;
+}
+
+// Move the cloth onto the height of a collider center, so half of it starts in contact
+void drop_onto(Cloth &cloth, const glm::vec3 &center)
+{
+    for (int i = 0; i < cloth.masses.size(); i++)
+    {
+        cloth.masses.position[i].y += center.y - cloth.cloth_pos.y;
+    }
+}
+
+/**
+ * Time op until min_seconds have passed, at least 5 calls. setup runs before
+ * every call, outside of the timed region, to restore the state op consumes.
+ */
+void measure(double min_seconds, const function<void()> &setup, const function<void()> &op, int &calls, double &median_ns, double &min_ns)
+{
+    vector<double> samples;
+    double spent = 0.0;
+    setup();
+    op(); // warm up
+    while (samples.size() < 5 || spent < min_seconds)
+    {
+        setup();
+        auto start = chrono::steady_clock::now();
+        op();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        samples.push_back(seconds * 1e9);
+        spent += seconds;
+    }
+    sort(samples.begin(), samples.end());
+    calls = (int)samples.size();
+    median_ns = samples[samples.size() / 2];
+    min_ns = samples[0];
+}
+
+void print_csv(const vector<BenchmarkResult> &results)
+{
+    cout << "benchmark,kernel,resolution,masses,springs,threads,calls,ns_per_call,min_ns_per_call,ns_per_mass,ns_per_spring" << endl;
+    for (const auto &r : results)
+    {
+        cout << r.name << "," << r.kernel << "," << r.resolution << "," << r.masses << "," << r.springs << "," << r.threads << ","
+             << r.calls << "," << r.median_ns << "," << r.min_ns << "," << r.median_ns / r.masses << "," << r.median_ns / r.springs << endl;
+    }
+}
+
+void print_json(const vector<BenchmarkResult> &results)
+{
+    cout << "[" << endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const auto &r = results[i];
+        cout << "  {\"benchmark\": \"" << r.name << "\", \"kernel\": \"" << r.kernel << "\", \"resolution\": " << r.resolution
+             << ", \"masses\": " << r.masses << ", \"springs\": " << r.springs << ", \"threads\": " << r.threads
+             << ", \"calls\": " << r.calls << ", \"ns_per_call\": " << r.median_ns << ", \"min_ns_per_call\": " << r.min_ns
+             << ", \"ns_per_mass\": " << r.median_ns / r.masses << ", \"ns_per_spring\": " << r.median_ns / r.springs << "}"
+             << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    cout << "]" << endl;
+}
+
+/**
+ * Microbenchmarks of the pieces of a simulation step.
+ *
+ * Usage: cloth_bench [--resolutions 32,64,128,256] [--threads 1,N] [--kernels scalar,avx2,avx512]
+ *                    [--seconds S] [--filter text] [--format csv|json]
+ *
+ * Every benchmark runs for every resolution and thread count; forces and the
+ * integrators also run for every spring kernel this CPU supports. Times are
+ * the median of the calls, per call, per mass and per spring.
+ */
+int main(int argc, const char *argv[])
+{
+    vector<int> resolutions = {32, 64, 128, 256};
+    vector<int> thread_counts = {1};
+    int hardware_threads = (int)std::thread::hardware_concurrency();
+    if (hardware_threads > 1)
+    {
+        thread_counts.push_back(hardware_threads);
+    }
+    vector<string> kernels = {"scalar", "avx2", "avx512"};
+    double min_seconds = 0.2;
+    string filter;
+    string format = "csv";
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--resolutions") && i + 1 < argc)
+        {
+            resolutions = parse_list(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            thread_counts = parse_list(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--kernels") && i + 1 < argc)
+        {
+            kernels.clear();
+            stringstream in(argv[++i]);
+            string item;
+            while (getline(in, item, ','))
+            {
+                kernels.push_back(item);
+            }
+        }
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+        {
+            min_seconds = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc)
+        {
+            format = argv[++i];
+        }
+        else
+        {
+            cerr << "Usage: cloth_bench [--resolutions 32,64,128,256] [--threads 1,N] [--kernels scalar,avx2,avx512]" << endl
+                 << "                   [--seconds S] [--filter text] [--format csv|json]" << endl;
+            return 1;
+        }
+    }
+    kernels.erase(remove_if(kernels.begin(), kernels.end(), [](const string &k) { return !spring_kernel_supported(k.c_str()); }), kernels.end());
+
+    Ball ball;
+    Cube cube;
+    Rectangle rectangle;
+    ColliderScene ball_scene, ball_sdf_scene, cube_scene, rectangle_scene, props_scene;
+    pick_collider("ball", ball, cube, rectangle, ball_scene);
+    pick_collider("ball_sdf", ball, cube, rectangle, ball_sdf_scene);
+    pick_collider("cube", ball, cube, rectangle, cube_scene);
+    pick_collider("rectangle", ball, cube, rectangle, rectangle_scene);
+    pick_collider("props", ball, cube, rectangle, props_scene);
+    vector<BenchmarkResult> results;
+    for (int threads : thread_counts)
+    {
+        ThreadPool pool(threads);
+        for (int n : resolutions)
+        {
+            Cloth cloth(ClothConfig(n, n));
+            cloth.set_thread_pool(&pool);
+            crumple(cloth);
+            const Masses initial = cloth.masses;
+            ClothConfig fem_config(n, n);
+            fem_config.membrane = MembraneModel::Fem;
+            Cloth fem_cloth(fem_config);
+            fem_cloth.set_thread_pool(&pool);
+            crumple(fem_cloth);
+            const double rk45_delta_t = cloth.rk45_delta_t;
+            auto restore = [&]() {
+                restore_cloth(cloth, initial, rk45_delta_t);
+                restore_cloth(fem_cloth, initial, rk45_delta_t);
+            };
+            auto no_setup = []() {};
+            const double explicit_dt = TIME_STEP * ClothConfig::reference_masses / n;
+
+            auto run = [&](const string &name, const string &kernel, const function<void()> &setup, const function<void()> &op) {
+                if (!filter.empty() && name.find(filter) == string::npos)
+                {
+                    return;
+                }
+                BenchmarkResult r = {name, kernel, n, cloth.masses.size(), cloth.springs.size(), pool.size(), 0, 0.0, 0.0};
+                restore();
+                measure(min_seconds, setup, op, r.calls, r.median_ns, r.min_ns);
+                results.push_back(r);
+                cerr << name << " " << kernel << " " << n << "x" << n << " threads " << pool.size() << ": " << r.median_ns * 1e-3 << " us" << endl;
+            };
+
+            for (const string &kernel : kernels)
+            {
+                cloth.set_spring_kernel(kernel.c_str());
+                run("compute_forces", kernel, no_setup, [&]() { cloth.compute_forces(); });
+                run("step_euler", kernel, restore, [&]() { cloth.step(true, nullptr, explicit_dt); });
+                run("step_rk4", kernel, restore, [&]() { cloth.rk4_step(true, nullptr, explicit_dt); });
+                run("frame_rk45", kernel, restore, [&]() { cloth.rk45_step(true, nullptr, TIME_STEP * 25); });
+                run("step_verlet", kernel, restore, [&]() { cloth.explicit_verlet(true, nullptr, explicit_dt); });
+                run("step_implicit", kernel, restore, [&]() { cloth.implicit_step(true, nullptr, TIME_STEP * 25); });
+                fem_cloth.set_spring_kernel(kernel.c_str());
+                run("compute_forces_fem", kernel, no_setup, [&]() { fem_cloth.compute_forces(); });
+                run("step_euler_fem", kernel, restore, [&]() { fem_cloth.step(true, nullptr, explicit_dt); });
+                run("step_implicit_fem", kernel, restore, [&]() { fem_cloth.implicit_step(true, nullptr, TIME_STEP * 25); });
+            }
+            cloth.set_spring_kernel(best_spring_kernel());
+            const string kernel = "-";
+            run("step_xpbd", kernel, restore, [&]() { cloth.xpbd_step(true, nullptr, TIME_STEP * 5); });
+            run("solve_constraints", kernel, restore, [&]() { cloth.solve_constraints(cloth.constraints_iterations); });
+            run("compute_normal", kernel, no_setup, [&]() { cloth.compute_normal(); });
+            run("self_collision", kernel, restore, [&]() { cloth.collide_with_self(); });
+            run("collision_ball", kernel, [&]() { restore(); drop_onto(cloth, ball.center); }, [&]() { cloth.collisionResponse(&ball_scene); });
+            run("collision_ball_sdf", kernel, [&]() { restore(); drop_onto(cloth, ball.center); }, [&]() { cloth.collisionResponse(&ball_sdf_scene); });
+            run("collision_cube", kernel, [&]() { restore(); drop_onto(cloth, cube.center); }, [&]() { cloth.collisionResponse(&cube_scene); });
+            run("collision_rectangle", kernel, [&]() { restore(); drop_onto(cloth, rectangle.center); }, [&]() { cloth.collisionResponse(&rectangle_scene); });
+            run("collision_props", kernel, [&]() { restore(); drop_onto(cloth, glm::vec3(0.0f, 8.0f, 0.0f)); }, [&]() { cloth.collisionResponse(&props_scene); });
+        }
+    }
+
+    if (format == "json")
+    {
+        print_json(results);
+    }
+    else
+    {
+        print_csv(results);
+    }
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "include/cloth.h"
+#include "include/driver.h"
+
+#define TIME_STEP 0.01
+
+using namespace std;
+
+void usage()
+{
+    cout << "Usage: cloth_scaling [Euler|RK|RK45|VERLET|IMPLICIT|XPBD] [--max N] [--seconds S] [--threads T]" << endl;
+}
+
+/**
+ * Compare every spring kernel this CPU supports against the scalar one on a
+ * stretched and crumpled cloth. Returns false if any force differs by more than
+ * 1e-12 of the force scale k * rest_len of its spring.
+ */
+bool check_spring_kernels()
+{
+    Cloth cloth(ClothConfig(64, 64));
+    for (int i = 0; i < cloth.masses.size(); i++)
+    {
+        glm::dvec3 &p = cloth.masses.position[i];
+        p += glm::dvec3(0.05 * std::sin(3.0 * i), 0.3 * std::sin(0.7 * p.x) * std::cos(1.3 * p.z), 0.05 * std::cos(5.0 * i));
+    }
+
+    int n = cloth.springs.size();
+    std::vector<double> reference[3] = {std::vector<double>(n), std::vector<double>(n), std::vector<double>(n)};
+    std::vector<double> result[3] = {std::vector<double>(n), std::vector<double>(n), std::vector<double>(n)};
+    spring_forces_scalar(cloth.masses.position.data(), cloth.springs.mass1.data(), cloth.springs.mass2.data(),
+                         cloth.springs.rest_len.data(), cloth.springs.spring_constant.data(),
+                         reference[0].data(), reference[1].data(), reference[2].data(), 0, n);
+
+    bool ok = true;
+    for (const char *name : {"avx2", "avx512"})
+    {
+        SpringKernel kernel = spring_kernel_by_name(name);
+        if (kernel == nullptr)
+        {
+            cout << "spring kernel " << name << ": not supported" << endl;
+            continue;
+        }
+        // Odd range so the scalar tail of the vector kernels is covered as well
+        kernel(cloth.masses.position.data(), cloth.springs.mass1.data(), cloth.springs.mass2.data(),
+               cloth.springs.rest_len.data(), cloth.springs.spring_constant.data(),
+               result[0].data(), result[1].data(), result[2].data(), 0, n - 3);
+        kernel(cloth.masses.position.data(), cloth.springs.mass1.data(), cloth.springs.mass2.data(),
+               cloth.springs.rest_len.data(), cloth.springs.spring_constant.data(),
+               result[0].data(), result[1].data(), result[2].data(), n - 3, n);
+
+        double max_error = 0.0;
+        for (int s = 0; s < n; s++)
+        {
+            glm::dvec3 r(reference[0][s], reference[1][s], reference[2][s]);
+            glm::dvec3 v(result[0][s], result[1][s], result[2][s]);
+            max_error = std::max(max_error, glm::length(v - r) / (cloth.springs.spring_constant[s] * cloth.springs.rest_len[s]));
+        }
+        cout << "spring kernel " << name << ": max error " << scientific << max_error << defaultfloat << endl;
+        ok = ok && max_error <= 1e-12;
+    }
+    return ok;
+}
+
+// The vector membrane kernels against the scalar one, on the same crumpled grid
+bool check_membrane_kernels()
+{
+    ClothConfig config(64, 64);
+    config.membrane = MembraneModel::Fem;
+    Cloth cloth(config);
+    for (int i = 0; i < cloth.masses.size(); i++)
+    {
+        glm::dvec3 &p = cloth.masses.position[i];
+        p += glm::dvec3(0.05 * std::sin(3.0 * i), 0.3 * std::sin(0.7 * p.x) * std::cos(1.3 * p.z), 0.05 * std::cos(5.0 * i));
+    }
+
+    Membrane &membrane = cloth.membrane;
+    int n = membrane.size();
+    membrane_forces_scalar(cloth.masses.position.data(), membrane, 0, n);
+    const std::vector<double> reference[6] = {membrane.f1x, membrane.f1y, membrane.f1z, membrane.f2x, membrane.f2y, membrane.f2z};
+    double scale = 0.0;
+    for (const std::vector<double> &component : reference)
+    {
+        for (double f : component)
+        {
+            scale = std::max(scale, std::abs(f));
+        }
+    }
+
+    bool ok = true;
+    for (const char *name : {"avx2", "avx512"})
+    {
+        MembraneKernel kernel = membrane_kernel_by_name(name);
+        if (kernel == nullptr)
+        {
+            cout << "membrane kernel " << name << ": not supported" << endl;
+            continue;
+        }
+        kernel(cloth.masses.position.data(), membrane, 0, n - 3);
+        kernel(cloth.masses.position.data(), membrane, n - 3, n);
+        const std::vector<double> *result[6] = {&membrane.f1x, &membrane.f1y, &membrane.f1z, &membrane.f2x, &membrane.f2y, &membrane.f2z};
+        double max_error = 0.0;
+        for (int c = 0; c < 6; c++)
+        {
+            for (int t = 0; t < n; t++)
+            {
+                max_error = std::max(max_error, std::abs((*result[c])[t] - reference[c][t]) / scale);
+            }
+        }
+        cout << "membrane kernel " << name << ": max error " << scientific << max_error << defaultfloat << endl;
+        ok = ok && max_error <= 1e-12;
+    }
+    return ok;
+}
+
+/**
+ * Step time of one cloth from 32x32 up to 1024x1024 masses.
+ *
+ * Usage: cloth_scaling [Euler|RK|RK45|VERLET|IMPLICIT|XPBD] [--max N] [--seconds S] [--threads T]
+ *
+ * The spring kernels are checked against the scalar one first, set CLOTH_SIMD
+ * to scalar, avx2 or avx512 to time a specific kernel.
+ *
+ * Every resolution covers the same 14x14 cloth, so the time step is shrunk
+ * with the grid spacing to stay inside the explicit stability limit. IMPLICIT
+ * has no such limit and takes the whole 25-substep frame of the viewer at once,
+ * as does RK45 with steps of its own choosing. XPBD takes the 5 substeps per
+ * frame of the viewer.
+ */
+int main(int argc, const char *argv[])
+{
+    string method = "Euler";
+    int max_resolution = 1024;
+    double min_seconds = 1.0;
+    int threads = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--max") && i + 1 < argc)
+        {
+            max_resolution = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+        {
+            min_seconds = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (is_step_method(argv[i]))
+        {
+            method = argv[i];
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (!check_spring_kernels())
+    {
+        cout << "ERROR::cloth_scaling : Spring kernels disagree with the scalar kernel." << endl;
+        return 1;
+    }
+    if (!check_membrane_kernels())
+    {
+        cout << "ERROR::cloth_scaling : Membrane kernels disagree with the scalar kernel." << endl;
+        return 1;
+    }
+
+    ThreadPool pool(threads);
+    cout << "method " << method << ", threads " << pool.size() << ", spring kernel " << best_spring_kernel() << endl;
+    cout << setw(10) << "grid" << setw(10) << "masses" << setw(10) << "springs" << setw(12) << "setup ms"
+         << setw(10) << "steps" << setw(12) << "ms/step" << setw(14) << "ns/mass/step" << endl;
+
+    for (int n = ClothConfig::reference_masses; n <= max_resolution; n *= 2)
+    {
+        auto setup_start = chrono::high_resolution_clock::now();
+        Cloth cloth(ClothConfig(n, n));
+        cloth.set_thread_pool(&pool);
+        auto setup_end = chrono::high_resolution_clock::now();
+        double delta_t = TIME_STEP * ClothConfig::reference_masses / n;
+        if (method == "IMPLICIT" || method == "RK45")
+        {
+            delta_t = TIME_STEP * 25;
+        }
+        else if (method == "XPBD")
+        {
+            delta_t = TIME_STEP * 5;
+        }
+
+        auto do_step = [&]() { step_cloth(cloth, method, true, nullptr, delta_t); };
+
+        // Warm up caches and let the cloth start moving
+        do_step();
+        int steps = 0;
+        auto start = chrono::high_resolution_clock::now();
+        double elapsed = 0.0;
+        while (steps < 3 || elapsed < min_seconds)
+        {
+            do_step();
+            steps++;
+            elapsed = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        }
+
+        double ms_per_step = elapsed * 1e3 / steps;
+        cout << setw(10) << (to_string(n) + "x" + to_string(n)) << setw(10) << cloth.masses.size() << setw(10) << cloth.springs.size()
+             << setw(12) << fixed << setprecision(2) << chrono::duration<double, milli>(setup_end - setup_start).count()
+             << setw(10) << steps << setw(12) << setprecision(3) << ms_per_step
+             << setw(14) << setprecision(1) << ms_per_step * 1e6 / cloth.masses.size() << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "include/driver.h"
+
+using namespace std;
+
+// One cloth of the batch, as read from a line of the parameter list
+struct BatchJob
+{
+    string name;
+    string method = "Euler";
+    string collider = "none";
+    ColliderScene scene; // The collider preset plus the colliders of the scene file
+    int frames = 40;
+    bool constraint = true;
+    bool self_collision = false;
+    bool continuous_collision = true;
+    bool sleeping = false;
+    ClothConfig config;
+
+    // Filled in by the run
+    double seconds = 0.0;
+    long steps = 0;
+    uint64_t hash = 0;
+    bool finite = true;
+};
+
+void usage()
+{
+    cout << "Usage: cloth_batch PARAMETERS [--threads T] [--out DIR]" << endl
+         << "  PARAMETERS has one cloth per line as key=value pairs, # starts a comment:" << endl
+         << "    name method resolution width height frames collider scene constraint self_collision ccd sleep" << endl
+         << "    structural shear bending damp pin thickness" << endl
+         << "    membrane (springs or fem) young poisson" << endl;
+}
+
+bool parse_jobs(const char *path, vector<BatchJob> &jobs)
+{
+    ifstream in(path);
+    if (!in)
+    {
+        cout << "ERROR::cloth_batch : Failed to open " << path << endl;
+        return false;
+    }
+    string line;
+    int line_number = 0;
+    while (getline(in, line))
+    {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        stringstream fields(line);
+        string field;
+        BatchJob job;
+        bool empty = true;
+        while (fields >> field)
+        {
+            empty = false;
+            size_t equals = field.find('=');
+            if (equals == string::npos)
+            {
+                cout << "ERROR::cloth_batch : Line " << line_number << ": expected key=value, got " << field << endl;
+                return false;
+            }
+            string key = field.substr(0, equals);
+            string value = field.substr(equals + 1);
+            if (key == "name")
+            {
+                job.name = value;
+            }
+            else if (key == "method")
+            {
+                job.method = value;
+            }
+            else if (key == "collider")
+            {
+                job.collider = value;
+            }
+            else if (key == "scene")
+            {
+                if (!load_scene(value, job.scene))
+                {
+                    return false;
+                }
+            }
+            else if (key == "frames")
+            {
+                job.frames = atoi(value.c_str());
+            }
+            else if (key == "constraint")
+            {
+                job.constraint = atoi(value.c_str()) != 0;
+            }
+            else if (key == "self_collision")
+            {
+                job.self_collision = atoi(value.c_str()) != 0;
+            }
+            else if (key == "ccd")
+            {
+                job.continuous_collision = atoi(value.c_str()) != 0;
+            }
+            else if (key == "sleep")
+            {
+                job.sleeping = atoi(value.c_str()) != 0;
+            }
+            else if (key == "resolution")
+            {
+                job.config.mass_per_row = job.config.mass_per_col = atoi(value.c_str());
+            }
+            else if (key == "width")
+            {
+                job.config.width = atof(value.c_str());
+            }
+            else if (key == "height")
+            {
+                job.config.height = atof(value.c_str());
+            }
+            else if (key == "structural")
+            {
+                job.config.structural_coef = atof(value.c_str());
+            }
+            else if (key == "shear")
+            {
+                job.config.shear_coef = atof(value.c_str());
+            }
+            else if (key == "bending")
+            {
+                job.config.bending_coef = atof(value.c_str());
+            }
+            else if (key == "damp")
+            {
+                job.config.damp_coef = atof(value.c_str());
+            }
+            else if (key == "pin")
+            {
+                job.config.pin_offset = atof(value.c_str());
+            }
+            else if (key == "membrane")
+            {
+                if (!parse_membrane(value, job.config.membrane))
+                {
+                    cout << "ERROR::cloth_batch : Line " << line_number << ": unknown membrane " << value << endl;
+                    return false;
+                }
+            }
+            else if (key == "young")
+            {
+                job.config.young_modulus = atof(value.c_str());
+            }
+            else if (key == "poisson")
+            {
+                job.config.poisson_ratio = atof(value.c_str());
+            }
+            else if (key == "thickness")
+            {
+                job.config.thickness = atof(value.c_str());
+            }
+            else
+            {
+                cout << "ERROR::cloth_batch : Line " << line_number << ": unknown key " << key << endl;
+                return false;
+            }
+        }
+        if (empty)
+        {
+            continue;
+        }
+        if (job.name.empty())
+        {
+            job.name = "cloth" + to_string(jobs.size());
+        }
+        if (!is_step_method(job.method) || !is_collider(job.collider) || job.config.mass_per_row < 2 || job.frames < 0)
+        {
+            cout << "ERROR::cloth_batch : Line " << line_number << ": bad method, collider, resolution or frames" << endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// Final positions and velocities, one mass per line
+bool write_state(const string &path, const BatchJob &job, const Cloth &cloth)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    fprintf(file, "# %s method %s grid %dx%d frames %d hash %016llx\n", job.name.c_str(), job.method.c_str(),
+            cloth.mass_per_row, cloth.mass_per_col, job.frames, (unsigned long long)job.hash);
+    for (int i = 0; i < cloth.masses.size(); i++)
+    {
+        const glm::dvec3 &p = cloth.masses.position[i];
+        const glm::dvec3 &v = cloth.masses.velocity[i];
+        fprintf(file, "%.17g %.17g %.17g %.17g %.17g %.17g\n", p.x, p.y, p.z, v.x, v.y, v.z);
+    }
+    return fclose(file) == 0;
+}
+
+/**
+ * Simulates many independent cloths in one process.
+ *
+ * Every cloth runs serially on one thread. The thread pool hands the cloths
+ * out in small chunks to whichever thread is free, so long and short jobs
+ * balance out, and setup happens once per process instead of once per run.
+ * Each final state goes to DIR/<name>.txt and a summary line per cloth plus
+ * the aggregate throughput go to stdout.
+ */
+int main(int argc, const char *argv[])
+{
+    const char *parameters = nullptr;
+    int threads = 0;
+    string out_dir;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+        {
+            out_dir = argv[++i];
+        }
+        else if (parameters == nullptr && argv[i][0] != '-')
+        {
+            parameters = argv[i];
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    vector<BatchJob> jobs;
+    if (parameters == nullptr)
+    {
+        usage();
+        return 1;
+    }
+    if (!parse_jobs(parameters, jobs))
+    {
+        return 1;
+    }
+    // Scenes are only read by the collision response, every cloth gets its own before the run
+    Ball ball;
+    Cube cube;
+    Rectangle rectangle;
+    for (BatchJob &job : jobs)
+    {
+        pick_collider(job.collider, ball, cube, rectangle, job.scene);
+    }
+    ThreadPool pool(threads);
+    vector<char> written(jobs.size(), 1);
+    auto start = chrono::high_resolution_clock::now();
+    pool.parallel_for(0, (int)jobs.size(), 1, [&](int begin, int end) {
+        for (int j = begin; j < end; j++)
+        {
+            BatchJob &job = jobs[j];
+            auto job_start = chrono::high_resolution_clock::now();
+            Cloth cloth(job.config);
+            cloth.self_collision = job.self_collision;
+            cloth.continuous_collision = job.continuous_collision;
+            cloth.sleeping = job.sleeping;
+            int substeps = substeps_per_frame(job.method, cloth.mass_per_row);
+            double delta_t = FRAME_TIME / substeps;
+            for (int frame = 0; frame < job.frames; frame++)
+            {
+                for (int i = 0; i < substeps; i++)
+                {
+                    step_cloth(cloth, job.method, job.constraint, &job.scene, delta_t);
+                }
+                cloth.compute_normal();
+            }
+            job.steps = (long)job.frames * substeps;
+            job.hash = state_hash(cloth.masses);
+            for (int i = 0; i < cloth.masses.size(); i++)
+            {
+                job.finite = job.finite && std::isfinite(glm::dot(cloth.masses.position[i], glm::dvec3(1.0)));
+            }
+            if (!out_dir.empty())
+            {
+                written[j] = write_state(out_dir + "/" + job.name + ".txt", job, cloth);
+            }
+            job.seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - job_start).count();
+        }
+    });
+    double elapsed = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+    long total_steps = 0;
+    double mass_steps = 0.0;
+    bool ok = true;
+    cout << left << setw(20) << "name" << setw(10) << "method" << right << setw(10) << "grid" << setw(10) << "steps"
+         << setw(12) << "ms" << setw(18) << "hash" << endl;
+    for (size_t j = 0; j < jobs.size(); j++)
+    {
+        const BatchJob &job = jobs[j];
+        total_steps += job.steps;
+        mass_steps += (double)job.steps * job.config.mass_per_row * job.config.mass_per_col;
+        cout << left << setw(20) << job.name << setw(10) << job.method << right
+             << setw(10) << (to_string(job.config.mass_per_row) + "x" + to_string(job.config.mass_per_col))
+             << setw(10) << job.steps << setw(12) << fixed << setprecision(2) << job.seconds * 1e3
+             << "  " << hex << setw(16) << setfill('0') << job.hash << dec << setfill(' ') << endl;
+        if (!job.finite)
+        {
+            cout << "ERROR::cloth_batch : " << job.name << ": non-finite positions." << endl;
+            ok = false;
+        }
+        if (!written[j])
+        {
+            cout << "ERROR::cloth_batch : " << job.name << ": failed to write its state to " << out_dir << endl;
+            ok = false;
+        }
+    }
+    cout << jobs.size() << " cloths on " << pool.size() << " threads in " << setprecision(3) << elapsed << " s: "
+         << setprecision(1) << total_steps / elapsed << " cloth-steps/s, " << setprecision(3) << mass_steps / elapsed * 1e-6 << " M mass-steps/s" << endl;
+    return ok ? 0 : 1;
+}
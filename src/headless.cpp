@@ -0,0 +1,210 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "include/driver.h"
+
+using namespace std;
+
+void usage()
+{
+    cout << "Usage: cloth_headless [--method Euler|RK|RK45|VERLET|IMPLICIT|XPBD] [--collider none|ball|ball_sdf|cube|rectangle|props]" << endl
+         << "                      [--scene file] [--resolution N] [--frames F] [--threads T] [--no-constraint] [--self-collision]" << endl
+         << "                      [--discrete-collision] [--membrane springs|fem] [--sleep] [--profile] [--trace file.json]" << endl;
+}
+
+/**
+ * Runs the simulation of the viewer without a window or OpenGL context and
+ * prints the timing and checksums of the final state.
+ *
+ * A frame covers the same 0.25 time units as a frame of the viewer: 25
+ * substeps for the explicit methods on the 32x32 grid (more on finer grids,
+ * which need a shorter step), 5 for XPBD and a single implicit step. RK45
+ * takes the frame in as many adaptive steps as its error control asks for.
+ */
+int main(int argc, const char *argv[])
+{
+    string method = "Euler";
+    string collider = "none";
+    string membrane = "springs";
+    const char *scene_path = nullptr;
+    int resolution = ClothConfig::reference_masses;
+    int frames = 100;
+    int threads = 1;
+    bool constraint = true;
+    bool self_collision = false;
+    bool continuous_collision = true;
+    bool sleeping = false;
+    bool profile = false;
+    const char *trace_path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--method") && i + 1 < argc)
+        {
+            method = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--collider") && i + 1 < argc)
+        {
+            collider = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--scene") && i + 1 < argc)
+        {
+            scene_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--resolution") && i + 1 < argc)
+        {
+            resolution = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+        {
+            frames = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--no-constraint"))
+        {
+            constraint = false;
+        }
+        else if (!strcmp(argv[i], "--self-collision"))
+        {
+            self_collision = true;
+        }
+        else if (!strcmp(argv[i], "--discrete-collision"))
+        {
+            continuous_collision = false;
+        }
+        else if (!strcmp(argv[i], "--sleep"))
+        {
+            sleeping = true;
+        }
+        else if (!strcmp(argv[i], "--membrane") && i + 1 < argc)
+        {
+            membrane = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--profile"))
+        {
+            profile = true;
+        }
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (resolution < 2 || frames < 0)
+    {
+        usage();
+        return 1;
+    }
+
+    Ball ball;
+    Cube cube;
+    Rectangle rectangle;
+    ColliderScene scene;
+    ClothConfig config(resolution, resolution);
+    if (!pick_collider(collider, ball, cube, rectangle, scene) || !is_step_method(method) || !parse_membrane(membrane, config.membrane))
+    {
+        usage();
+        return 1;
+    }
+    if (scene_path != nullptr && !load_scene(scene_path, scene))
+    {
+        return 1;
+    }
+    int substeps = substeps_per_frame(method, resolution);
+    double delta_t = FRAME_TIME / substeps;
+
+    ThreadPool pool(threads);
+    auto setup_start = chrono::high_resolution_clock::now();
+    Cloth cloth(config);
+    cloth.set_thread_pool(&pool);
+    cloth.self_collision = self_collision;
+    cloth.continuous_collision = continuous_collision;
+    cloth.sleeping = sleeping;
+    Profiler profiler;
+    if (profile)
+    {
+        cloth.set_profiler(&profiler);
+    }
+    auto setup_end = chrono::high_resolution_clock::now();
+
+    if (trace_path != nullptr)
+    {
+        Tracer::instance().start();
+    }
+    auto start = chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < frames; frame++)
+    {
+        TraceScope frame_trace("frame", "frame");
+        for (int i = 0; i < substeps; i++)
+        {
+            step_cloth(cloth, method, constraint, &scene, delta_t);
+        }
+        cloth.compute_normal();
+    }
+    double elapsed = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    if (trace_path != nullptr)
+    {
+        Tracer::instance().stop();
+        if (!Tracer::instance().write_json(trace_path))
+        {
+            cout << "ERROR::cloth_headless : Failed to write " << trace_path << endl;
+            return 1;
+        }
+    }
+
+    const int n = cloth.masses.size();
+    glm::dvec3 position_sum(0.0);
+    glm::dvec3 velocity_sum(0.0);
+    bool finite = true;
+    for (int i = 0; i < n; i++)
+    {
+        position_sum += cloth.masses.position[i];
+        velocity_sum += cloth.masses.velocity[i];
+        finite = finite && std::isfinite(glm::dot(cloth.masses.position[i], glm::dvec3(1.0)));
+    }
+    uint64_t hash = state_hash(cloth.masses);
+
+    cout << "method " << method << ", collider " << collider << " (" << scene.size() << " colliders), grid " << resolution << "x" << resolution
+         << ", threads " << pool.size() << ", spring kernel " << cloth.spring_kernel_name
+         << ", membrane " << membrane << ", constraint " << (constraint ? "on" : "off") << endl;
+    cout << "frames " << frames << ", substeps/frame " << substeps << ", dt " << delta_t << endl;
+    if (sleeping)
+    {
+        cout << "asleep tiles " << cloth.asleep_tiles << " of " << cloth.tile_asleep.size() << endl;
+    }
+    if (method == "RK45" && frames > 0)
+    {
+        cout << "adaptive steps/frame " << (double)cloth.rk45_accepted / frames << ", rejected/frame " << (double)cloth.rk45_rejected / frames
+             << ", force evaluations/frame " << 7.0 * (cloth.rk45_accepted + cloth.rk45_rejected) / frames << endl;
+    }
+    cout << fixed << setprecision(3)
+         << "setup ms " << chrono::duration<double, milli>(setup_end - setup_start).count()
+         << ", total ms " << elapsed * 1e3
+         << ", ms/frame " << (frames > 0 ? elapsed * 1e3 / frames : 0.0)
+         << ", ns/mass/step " << (frames > 0 ? elapsed * 1e9 / ((double)frames * substeps * n) : 0.0) << endl;
+    cout << setprecision(9)
+         << "position sum " << position_sum.x << " " << position_sum.y << " " << position_sum.z << endl
+         << "velocity sum " << velocity_sum.x << " " << velocity_sum.y << " " << velocity_sum.z << endl
+         << "state hash " << hex << setw(16) << setfill('0') << hash << dec << setfill(' ') << endl;
+    if (profile)
+    {
+        profiler.report(cout);
+    }
+    if (!finite)
+    {
+        cout << "ERROR::cloth_headless : Non-finite positions." << endl;
+        return 2;
+    }
+    return 0;
+}
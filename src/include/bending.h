@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mass.h"
+
+/**
+ * Quadratic isometric bending after Bergou et al., "A Quadratic Bending Model
+ * for Inextensible Surfaces". Every edge shared by two triangles forms a
+ * stencil with its two masses and the two masses opposite it. As long as the
+ * cloth bends without stretching, the bending energy of a stencil is
+ * (k / 2) |sum_i w_i x_i|^2, with cotangent weights w taken once from the flat
+ * rest shape. Summed over the stencils that is (k / 2) x^T Q x for a constant
+ * sparse Q, so the bending force -k Q x is a fixed stencil multiply and its
+ * Jacobian -k Q never changes. The weights carry the 1 / area of the stencil,
+ * so one stiffness bends the same at any grid resolution.
+ *
+ * On a regular grid most rows of Q are the same up to a shift. Consecutive
+ * masses with the same row form a run, and add_product multiplies a run as
+ * one fixed stencil that streams over contiguous positions.
+ */
+class IsometricBending
+{
+public:
+    // Edge masses first, then the opposite masses. Sorted by color, no two stencils of one color share a mass
+    std::vector<glm::ivec4> stencil_mass;
+    std::vector<glm::dvec4> stencil_weight;
+    std::vector<int> color_begin;
+    // Q, whose 3x3 blocks are multiples of the identity: the diagonal of every mass and the other
+    // entries of row i as column[row_begin[i] .. row_begin[i + 1]) with their weight
+    std::vector<double> diagonal;
+    std::vector<int> row_begin;
+    std::vector<int> column;
+    std::vector<double> weight;
+    // Masses run_begin[r] .. run_begin[r + 1] all have the row of mass run_begin[r], shifted
+    std::vector<int> run_begin;
+
+    int size() const { return (int)stencil_mass.size(); }
+
+    int color_count() const { return (int)color_begin.size() - 1; }
+
+    // Stencils of the edges of faces (three mass indices per triangle), with the current positions as the flat rest shape
+    void build(const Masses &masses, const std::vector<int> &faces)
+    {
+        clear();
+        const int mass_count = masses.size();
+        std::vector<glm::ivec4> stencils;
+        std::vector<glm::dvec4> weights;
+        for_each_interior_edge(faces, [&](int a, int b, int c, int d) {
+            glm::dvec4 w;
+            if (rest_weights(masses.position[a], masses.position[b], masses.position[c], masses.position[d], w))
+            {
+                stencils.push_back(glm::ivec4(a, b, c, d));
+                weights.push_back(w);
+            }
+        });
+
+        // Greedy coloring, a mass remembers the colors of the stencils it is already part of
+        // and taken_by[c] == s marks color c as taken by a neighbour of stencil s
+        std::vector<std::vector<int>> used(mass_count);
+        std::vector<int> taken_by;
+        std::vector<int> color(stencils.size());
+        int colors = 0;
+        for (int s = 0; s < (int)stencils.size(); s++)
+        {
+            const glm::ivec4 &m = stencils[s];
+            for (int k = 0; k < 4; k++)
+            {
+                for (int c : used[m[k]])
+                {
+                    taken_by[c] = s;
+                }
+            }
+            int c = 0;
+            while (c < colors && taken_by[c] == s)
+            {
+                c++;
+            }
+            if (c == colors)
+            {
+                colors++;
+                taken_by.push_back(-1);
+            }
+            color[s] = c;
+            for (int k = 0; k < 4; k++)
+            {
+                used[m[k]].push_back(c);
+            }
+        }
+        color_begin.assign(colors + 1, 0);
+        for (int c : color)
+        {
+            color_begin[c + 1]++;
+        }
+        for (int c = 0; c < colors; c++)
+        {
+            color_begin[c + 1] += color_begin[c];
+        }
+        std::vector<int> fill(color_begin.begin(), color_begin.end() - 1);
+        stencil_mass.resize(stencils.size());
+        stencil_weight.resize(stencils.size());
+        for (size_t s = 0; s < stencils.size(); s++)
+        {
+            int slot = fill[color[s]]++;
+            stencil_mass[slot] = stencils[s];
+            stencil_weight[slot] = weights[s];
+        }
+
+        assemble_rows(mass_count);
+    }
+
+    // y_i += scale (Q x)_i for the masses begin .. end
+    void add_product(const glm::dvec3 *x, double scale, glm::dvec3 *y, int begin, int end) const
+    {
+        const double *in = &x[0].x;
+        double *out = &y[0].x;
+        int r = int(std::upper_bound(run_begin.begin(), run_begin.end(), begin) - run_begin.begin()) - 1;
+        for (; begin < end; r++)
+        {
+            const int first = run_begin[r];
+            const int last = std::min(end, run_begin[r + 1]);
+            // A component of a mass sits 3 doubles from the same component of the next one,
+            // so every entry of the stencil is one pass over the doubles of the run
+            const double d = scale * diagonal[first];
+            for (int t = 3 * begin; t < 3 * last; t++)
+            {
+                out[t] += d * in[t];
+            }
+            for (int a = row_begin[first]; a < row_begin[first + 1]; a++)
+            {
+                const double w = scale * weight[a];
+                const double *shifted = in + 3 * (column[a] - first);
+                for (int t = 3 * begin; t < 3 * last; t++)
+                {
+                    out[t] += w * shifted[t];
+                }
+            }
+            begin = last;
+        }
+    }
+
+    void clear()
+    {
+        stencil_mass.clear();
+        stencil_weight.clear();
+        color_begin.clear();
+        diagonal.clear();
+        row_begin.clear();
+        column.clear();
+        weight.clear();
+        run_begin.clear();
+    }
+
+private:
+    // Call fn(a, b, c, d) for every edge (a, b) shared by exactly two triangles, c and d opposite it
+    template <class Fn>
+    static void for_each_interior_edge(const std::vector<int> &faces, Fn fn)
+    {
+        struct HalfEdge
+        {
+            int low, high, opposite;
+        };
+        std::vector<HalfEdge> edges;
+        edges.reserve(faces.size());
+        for (size_t f = 0; f + 2 < faces.size(); f += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                int a = faces[f + k];
+                int b = faces[f + (k + 1) % 3];
+                edges.push_back({std::min(a, b), std::max(a, b), faces[f + (k + 2) % 3]});
+            }
+        }
+        std::sort(edges.begin(), edges.end(), [](const HalfEdge &a, const HalfEdge &b) {
+            return a.low != b.low ? a.low < b.low : a.high != b.high ? a.high < b.high : a.opposite < b.opposite;
+        });
+        size_t begin = 0;
+        while (begin < edges.size())
+        {
+            size_t end = begin + 1;
+            while (end < edges.size() && edges[end].low == edges[begin].low && edges[end].high == edges[begin].high)
+            {
+                end++;
+            }
+            if (end - begin == 2)
+            {
+                fn(edges[begin].low, edges[begin].high, edges[begin].opposite, edges[begin + 1].opposite);
+            }
+            begin = end;
+        }
+    }
+
+    static double cotangent(const glm::dvec3 &a, const glm::dvec3 &b)
+    {
+        return glm::dot(a, b) / glm::length(glm::cross(a, b));
+    }
+
+    /**
+     * w = sqrt(3 / (A0 + A1)) (c03 + c04, c01 + c02, -c01 - c03, -c02 - c04) for the
+     * edge x0 x1 with the triangles x0 x1 x2 and x0 x1 x3, where c0j is the
+     * cotangent of the angle the edge makes with e_j at x0 (j = 1, 2) or at x1
+     * (j = 3, 4). False for a degenerate triangle.
+     */
+    static bool rest_weights(const glm::dvec3 &x0, const glm::dvec3 &x1, const glm::dvec3 &x2, const glm::dvec3 &x3, glm::dvec4 &w)
+    {
+        glm::dvec3 e0 = x1 - x0;
+        glm::dvec3 e1 = x2 - x0;
+        glm::dvec3 e2 = x3 - x0;
+        glm::dvec3 e3 = x2 - x1;
+        glm::dvec3 e4 = x3 - x1;
+        double area0 = 0.5 * glm::length(glm::cross(e0, e1));
+        double area1 = 0.5 * glm::length(glm::cross(e0, e2));
+        if (!(area0 > 0.0) || !(area1 > 0.0))
+        {
+            return false;
+        }
+        double c01 = cotangent(e0, e1);
+        double c02 = cotangent(e0, e2);
+        double c03 = cotangent(-e0, e3);
+        double c04 = cotangent(-e0, e4);
+        w = std::sqrt(3.0 / (area0 + area1)) * glm::dvec4(c03 + c04, c01 + c02, -c01 - c03, -c02 - c04);
+        return true;
+    }
+
+    // Q = sum over the stencils of w w^T, gathered row by row through the stencils of each mass
+    void assemble_rows(int mass_count)
+    {
+        std::vector<int> stencil_begin(mass_count + 1, 0);
+        for (const glm::ivec4 &m : stencil_mass)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                stencil_begin[m[k] + 1]++;
+            }
+        }
+        for (int i = 0; i < mass_count; i++)
+        {
+            stencil_begin[i + 1] += stencil_begin[i];
+        }
+        std::vector<int> stencil_of(stencil_begin[mass_count]);
+        std::vector<int> fill(stencil_begin.begin(), stencil_begin.end() - 1);
+        for (int s = 0; s < size(); s++)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                stencil_of[fill[stencil_mass[s][k]]++] = s;
+            }
+        }
+
+        diagonal.assign(mass_count, 0.0);
+        row_begin.assign(mass_count + 1, 0);
+        for (int i = 0; i < mass_count; i++)
+        {
+            const int row = (int)column.size();
+            for (int a = stencil_begin[i]; a < stencil_begin[i + 1]; a++)
+            {
+                const glm::ivec4 &m = stencil_mass[stencil_of[a]];
+                const glm::dvec4 &w = stencil_weight[stencil_of[a]];
+                double wi = 0.0;
+                for (int k = 0; k < 4; k++)
+                {
+                    if (m[k] == i)
+                    {
+                        wi = w[k];
+                    }
+                }
+                for (int k = 0; k < 4; k++)
+                {
+                    if (m[k] == i)
+                    {
+                        diagonal[i] += wi * w[k];
+                        continue;
+                    }
+                    int entry = row;
+                    while (entry < (int)column.size() && column[entry] != m[k])
+                    {
+                        entry++;
+                    }
+                    if (entry == (int)column.size())
+                    {
+                        column.push_back(m[k]);
+                        weight.push_back(0.0);
+                    }
+                    weight[entry] += wi * w[k];
+                }
+            }
+            // Columns in mass order, so a row walks the positions front to back
+            std::vector<std::pair<int, double>> entries;
+            for (int entry = row; entry < (int)column.size(); entry++)
+            {
+                entries.emplace_back(column[entry], weight[entry]);
+            }
+            std::sort(entries.begin(), entries.end());
+            for (size_t e = 0; e < entries.size(); e++)
+            {
+                column[row + e] = entries[e].first;
+                weight[row + e] = entries[e].second;
+            }
+            row_begin[i + 1] = (int)column.size();
+        }
+
+        run_begin.clear();
+        for (int i = 0; i < mass_count; i++)
+        {
+            if (run_begin.empty() || !same_row(run_begin.back(), i))
+            {
+                run_begin.push_back(i);
+            }
+        }
+        run_begin.push_back(mass_count);
+    }
+
+    /**
+     * Whether row i is row first shifted by i - first, with weights equal up to
+     * rounding. The weights of row i are then set to those of row first, so the
+     * run and the rows hold exactly the same Q.
+     */
+    bool same_row(int first, int i)
+    {
+        const int shift = i - first;
+        const int count = row_begin[first + 1] - row_begin[first];
+        if (row_begin[i + 1] - row_begin[i] != count)
+        {
+            return false;
+        }
+        const double tolerance = 1e-9 * std::abs(diagonal[first]);
+        if (std::abs(diagonal[i] - diagonal[first]) > tolerance)
+        {
+            return false;
+        }
+        for (int k = 0; k < count; k++)
+        {
+            int a = row_begin[first] + k;
+            int b = row_begin[i] + k;
+            if (column[b] != column[a] + shift || std::abs(weight[b] - weight[a]) > tolerance)
+            {
+                return false;
+            }
+        }
+        diagonal[i] = diagonal[first];
+        std::copy(weight.begin() + row_begin[first], weight.begin() + row_begin[first + 1], weight.begin() + row_begin[i]);
+        return true;
+    }
+};
@@ -1,392 +1,1220 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
 #include "spring.h"
-#include "rigid.h"
+#include "bending.h"
+#include "membrane.h"
+#include "collider.h"
+#include "thread_pool.h"
+#include "spring_kernel.h"
+#include "implicit.h"
+#include "self_collision.h"
+#include "profiler.h"
 #define GLM_ENABLE_EXPERIMENTAL
+
+// In-plane material of a cloth
+enum class MembraneModel
+{
+    Springs, // Structural and shear springs
+    Fem      // Saint Venant-Kirchhoff triangle elements over the faces
+};
+
+/**
+ * Grid resolution, physical size and fabric coefficients of a cloth.
+ * The coefficients of Cloth were tuned on the 32x32 reference grid over a
+ * 14x14 square and are rescaled from it, so the same fabric behaves the same
+ * at any resolution.
+ */
+struct ClothConfig
+{
+    static constexpr int reference_masses = 32;
+    static constexpr double reference_size = 14.0;
+
+    int mass_per_row = reference_masses; // Masses along x
+    int mass_per_col = reference_masses; // Masses along z
+    double width = reference_size;       // Rest spacing along x is width / mass_per_row
+    double height = reference_size;      // Rest spacing along z is height / mass_per_col
+    // Fabric as tuned on the reference grid
+    double structural_coef = 300.0;
+    double shear_coef = 50.0;
+    double bending_coef = 0.1; // Stiffness of the isometric bending energy, the same at any resolution
+    MembraneModel membrane = MembraneModel::Springs;
+    // Fem only: 2D Young's modulus, the same at any resolution. 600 sags like the springs; VERLET,
+    // which scales the forces by 10, needs 200 or less to stay stable
+    double young_modulus = 600.0;
+    double poisson_ratio = 0.3; // Fem only
+    double damp_coef = 0.65;
+    double pin_offset = 0.8; // The two pinned corners are pulled towards each other by this much
+    double thickness = 0.05; // Distance self-collision keeps between a mass and the triangles of other masses
+
+    ClothConfig() {}
+    ClothConfig(int row, int col)
+        : mass_per_row(row), mass_per_col(col) {}
+    ClothConfig(int row, int col, double w, double h)
+        : mass_per_row(row), mass_per_col(col), width(w), height(h) {}
+};
+
 class Cloth
 {
 public:
-    const int mass_per_row = 32;
-    const int mass_per_col = 32;
-    const double mass_density = (double)mass_per_row / 14.0;
-    const double structural_coef = 300.0;
-    const double shear_coef = 50.0;
-    const double flexion_coef = 100.0;
-    const double damp_coef = 0.65;
+    const ClothConfig config;
+    const int mass_per_row;
+    const int mass_per_col;
+    const double row_density; // Masses per unit length along x
+    const double col_density; // Masses per unit length along z
+    // Each mass stands for the cloth area around it, relative to the reference grid.
+    // In-plane stiffness of a regular spring lattice does not depend on its spacing,
+    // so spring constants stay as tuned while mass, damping and drag scale with area.
+    const double mass_scale;
+    const double structural_coef;
+    const double shear_coef;
+    const double bending_coef;
+    const double damp_coef;
+    const double pin_offset;
     const glm::dvec3 gravity = glm::dvec3(0.0, -2.0, 0.0);
     const glm::vec3 cloth_pos = glm::vec3(-7.0, 18.0, -6.0);
     bool draw_texture = false;
     const double refine_angle = std::cos(glm::radians(135.0f));
     const int constraints_iterations = 6;
+    const double constraints_tolerance = 1e-3; // Parallel projection stops once no spring is overstretched by more than this fraction
     const int refine_iterations = 3;
     const double visco_coef = 0.5f;                       // Viscosity coefficient
     const glm::dvec3 u_fluid = glm::dvec3(0.0, 0.0, 0.0); // Assume fluid = 0 with no wind
+    const double implicit_tolerance = 1e-4; // Relative CG residual of the implicit step
+    const int implicit_iterations = 200;
+    const double rk45_tolerance = 1e-3;     // Largest error of an adaptive step, in rest spacings
+    long rk45_accepted = 0;                 // Adaptive steps taken and retaken, 7 force evaluations each
+    long rk45_rejected = 0;
+    const int xpbd_iterations = 10;         // Constraint sweeps per XPBD step
+    const int self_collision_iterations = 2;
+    static constexpr int face_tile = 8;
+    bool self_collision = false;            // Collide the cloth with itself after the rigid body
+    bool continuous_collision = true;       // Sweep the masses through the step against the colliders instead of testing where they end up
+    bool sleeping = false;                  // Hold the tiles of masses that stay still until something moves them again
+    const double sleep_speed = 0.05;        // A tile is still while the rms speed of its masses is below this many rest spacings per time unit
+    const double sleep_delay = 1.0;         // Time a tile stays still before it falls asleep
+    const double wake_speed = 1.0;          // A sleeping tile wakes once a neighbouring tile moves faster than this
 
-    std::vector<Mass *> masses;
-    std::vector<Spring *> springs;
-    std::vector<Mass *> faces;
+    Masses masses;
+    Springs springs;         // Forces with MembraneModel::Springs; constraints, XPBD and the implicit sparsity either way
+    IsometricBending bending;
+    Membrane membrane;       // Only built for MembraneModel::Fem
+    std::vector<int> faces; // Three mass indices per triangle
+    std::vector<int> face_tile_begin; // Faces come in tiles of face_tile x face_tile grid cells, tile t starts at triangle face_tile_begin[t]
 
-    Cloth()
+    // Optional worker pool, the simulation runs on the calling thread without one
+    ThreadPool *pool = nullptr;
+    // Optional per-phase timings of the step
+    Profiler *profiler = nullptr;
+    // Per-spring elastic force on mass2, written by the spring kernel
+    std::vector<double> spring_force_x;
+    std::vector<double> spring_force_y;
+    std::vector<double> spring_force_z;
+    const char *spring_kernel_name = best_spring_kernel();
+    SpringKernel spring_kernel = spring_kernel_by_name(spring_kernel_name);
+    MembraneKernel membrane_kernel = membrane_kernel_by_name(spring_kernel_name);
+    // Linear system of the implicit step, kept so stepping does not allocate
+    SpringBlockMatrix implicit_matrix;
+    ConjugateGradient implicit_solver;
+    std::vector<glm::dvec3> implicit_rhs;
+    std::vector<glm::dvec3> implicit_dv;
+    // Runge Kutta state at the start of the step and running sums of the stage slopes
+    std::vector<glm::dvec3> rk4_initial_position;
+    std::vector<glm::dvec3> rk4_initial_velocity;
+    std::vector<glm::dvec3> rk4_position_sum;
+    std::vector<glm::dvec3> rk4_velocity_sum;
+    // Dormand-Prince slopes of every stage, forces applied before the step and the size of the next step
+    std::vector<glm::dvec3> rk45_velocity[7];
+    std::vector<glm::dvec3> rk45_acceleration[7];
+    std::vector<glm::dvec3> rk45_applied_force;
+    double rk45_delta_t = 0.01;
+    // Accumulated XPBD multiplier of every spring and every bending stencil during a step
+    std::vector<double> xpbd_lambda;
+    std::vector<glm::dvec3> xpbd_bending_lambda;
+    // Tile bounds of the collider broadphase
+    RigidCollision rigid_collider;
+    // Spatial hash and contacts of the self-collision pass
+    SelfCollision self_collider;
+    // Sleeping state of every face_tile x face_tile tile of masses, the pinned masses and,
+    // while any tile sleeps, the spring ranges with an end that still moves
+    std::vector<unsigned char> tile_asleep;
+    std::vector<double> tile_still_time;
+    std::vector<double> tile_speed;
+    std::vector<unsigned char> pinned;
+    std::vector<glm::ivec2> awake_springs;
+    std::vector<int> woken_tiles;
+    int asleep_tiles = 0;
+    const ColliderScene *sleep_scene = nullptr;  // The scene of the last step and its version, a change wakes every tile
+    int sleep_scene_version = 0;
+
+    Cloth(const ClothConfig &_config = ClothConfig())
+        : config(_config),
+          mass_per_row(_config.mass_per_row),
+          mass_per_col(_config.mass_per_col),
+          row_density(_config.mass_per_row / _config.width),
+          col_density(_config.mass_per_col / _config.height),
+          mass_scale((double)ClothConfig::reference_masses / _config.mass_per_row * _config.width / ClothConfig::reference_size *
+                     (double)ClothConfig::reference_masses / _config.mass_per_col * _config.height / ClothConfig::reference_size),
+          structural_coef(_config.structural_coef),
+          shear_coef(_config.shear_coef),
+          bending_coef(_config.bending_coef),
+          damp_coef(_config.damp_coef),
+          pin_offset(_config.pin_offset)
     {
         initialize_masses();
+        pinned.assign(masses.size(), 0);
         link_springs();
         initialize_face();
+        bending.build(masses, faces);
+        if (uses_membrane())
+        {
+            membrane.build(masses, faces, config.young_modulus, config.poisson_ratio);
+            membrane.link_springs(springs);
+        }
 
-        fixed_mass(get_mass(0, 0), glm::dvec3(0.8, 0.0, 0.0));
-        fixed_mass(get_mass(mass_per_row - 1, 0), glm::dvec3(-0.8, 0.0, 0.0));
+        fixed_mass(get_mass(0, 0), glm::dvec3(pin_offset, 0.0, 0.0));
+        fixed_mass(get_mass(mass_per_row - 1, 0), glm::dvec3(-pin_offset, 0.0, 0.0));
+        compute_normal();
     }
 
     ~Cloth()
     {
-        for (int i = 0; i < masses.size(); i++)
-        {
-            delete masses[i];
-        }
-
-        for (int i = 0; i < springs.size(); i++)
-        {
-            delete springs[i];
-        }
         masses.clear();
         springs.clear();
+        bending.clear();
+        membrane.clear();
         faces.clear();
+        face_tile_begin.clear();
     }
 
 public:
-    Mass *get_mass(int x, int y)
+    int get_mass(int x, int y)
     {
-        return masses[y * mass_per_row + x];
+        return y * mass_per_row + x;
     }
 
-    void fixed_mass(Mass *mass, glm::dvec3 offset)
+    void fixed_mass(int i, glm::dvec3 offset)
     {
-        mass->position += offset;
-        mass->is_fixed = true;
+        masses.position[i] += offset;
+        masses.set_fixed(i, true);
+        pinned[i] = 1;
     }
 
     void initialize_masses()
     {
-        for (int i = 0; i < mass_per_row; i++)
+        masses.reserve(mass_per_row * mass_per_col);
+        for (int i = 0; i < mass_per_col; i++)
         {
-            for (int j = 0; j < mass_per_col; j++)
+            for (int j = 0; j < mass_per_row; j++)
             {
                 glm::dvec2 text_coord((double)j / (mass_per_row - 1), (double)i / (1 - mass_per_col));
-                glm::dvec3 position((double)j / mass_density, 0, (double)i / mass_density);
-                Mass *mass = new Mass(position, text_coord, false);
-                masses.push_back(mass);
+                glm::dvec3 position((double)j / row_density, 0, (double)i / col_density);
+                masses.add(position, text_coord, false, mass_scale);
             }
         }
     }
 
+    /**
+     * Each spring also gets a color such that no two springs of one color share a mass.
+     * On the grid that takes two colors per direction, alternating along the
+     * direction the spring does not run in: structural 0-3, shear 4-7.
+     * Bending is not a spring, see IsometricBending.
+     */
     void link_springs()
     {
+        std::vector<Spring> linked;
         for (int i = 0; i < mass_per_row; i++)
         {
             for (int j = 0; j < mass_per_col; j++)
             {
-                Mass *mass = get_mass(i, j);
+                int mass = get_mass(i, j);
                 // structural springs
                 if (i < mass_per_row - 1)
                 {
-                    springs.push_back(new Spring(mass, get_mass(i + 1, j), structural_coef, Spring::STRUCTURAL));
+                    linked.push_back(Spring(masses, mass, get_mass(i + 1, j), structural_coef, Spring::STRUCTURAL, i % 2));
                 }
                 if (j < mass_per_col - 1)
                 {
-                    springs.push_back(new Spring(mass, get_mass(i, j + 1), structural_coef, Spring::STRUCTURAL));
+                    linked.push_back(Spring(masses, mass, get_mass(i, j + 1), structural_coef, Spring::STRUCTURAL, 2 + j % 2));
                 }
 
                 // shear springs
                 if (i < mass_per_row - 1 && j < mass_per_col - 1)
                 {
-                    springs.push_back(new Spring(mass, get_mass(i + 1, j + 1), structural_coef, Spring::SHEAR));
-                    springs.push_back(new Spring(get_mass(i + 1, j), get_mass(i, j + 1), structural_coef, Spring::SHEAR));
+                    linked.push_back(Spring(masses, mass, get_mass(i + 1, j + 1), structural_coef, Spring::SHEAR, 4 + j % 2));
+                    linked.push_back(Spring(masses, get_mass(i + 1, j), get_mass(i, j + 1), structural_coef, Spring::SHEAR, 6 + j % 2));
                 }
+            }
+        }
+        springs.build(linked);
+        springs.build_adjacency(masses.size());
+        spring_force_x.assign(springs.size(), 0.0);
+        spring_force_y.assign(springs.size(), 0.0);
+        spring_force_z.assign(springs.size(), 0.0);
+    }
 
-                // flexion springs
-                if (i < mass_per_row - 2)
-                {
-                    springs.push_back(new Spring(mass, get_mass(i + 2, j), flexion_coef, Spring::FLEXION));
-                }
-                if (j < mass_per_col - 2)
-                {
-                    springs.push_back(new Spring(mass, get_mass(i, j + 2), flexion_coef, Spring::FLEXION));
-                }
+    // Pick the spring and membrane force kernels ("scalar", "avx2" or "avx512"), false if this CPU lacks them
+    bool set_spring_kernel(const char *name)
+    {
+        SpringKernel kernel = spring_kernel_by_name(name);
+        if (kernel == nullptr)
+        {
+            return false;
+        }
+        spring_kernel = kernel;
+        membrane_kernel = membrane_kernel_by_name(name);
+        spring_kernel_name = name;
+        return true;
+    }
+
+    bool uses_membrane() const
+    {
+        return config.membrane == MembraneModel::Fem;
+    }
+
+    void set_thread_pool(ThreadPool *_pool)
+    {
+        pool = _pool;
+    }
+
+    void set_profiler(Profiler *_profiler)
+    {
+        profiler = _profiler;
+    }
+
+    bool is_parallel() const
+    {
+        return pool != nullptr && pool->size() > 1;
+    }
+
+    // Sum of compute_normal for a mass on the border, skipping the triangles off the grid
+    glm::dvec3 border_normal_sum(const glm::dvec3 *position, int i, int j) const
+    {
+        static const int ring[6][2] = {{1, 0}, {1, -1}, {0, -1}, {-1, 0}, {-1, 1}, {0, 1}};
+        const glm::dvec3 p = position[j * mass_per_row + i];
+        glm::dvec3 edge[6];
+        bool inside[6];
+        for (int k = 0; k < 6; k++)
+        {
+            int x = i + ring[k][0];
+            int y = j + ring[k][1];
+            inside[k] = x >= 0 && x < mass_per_row && y >= 0 && y < mass_per_col;
+            edge[k] = inside[k] ? position[y * mass_per_row + x] - p : glm::dvec3(0.0);
+        }
+        glm::dvec3 sum(0.0);
+        for (int k = 0; k < 6; k++)
+        {
+            if (inside[k] && inside[(k + 1) % 6])
+            {
+                sum += glm::cross(edge[k], edge[(k + 1) % 6]);
             }
         }
+        return sum;
+    }
+
+    // A degenerate neighbourhood keeps its last normal
+    static void set_normal(glm::dvec3 &normal, const glm::dvec3 &sum)
+    {
+        double length = glm::length(sum);
+        if (length > 0.0)
+        {
+            normal = sum / length;
+        }
     }
 
     void initialize_face()
     {
-        for (int i = 0; i < mass_per_row - 1; i++)
+        faces.reserve((mass_per_row - 1) * (mass_per_col - 1) * 6);
+        for (int tile_i = 0; tile_i < mass_per_row - 1; tile_i += face_tile)
         {
-            for (int j = 0; j < mass_per_col - 1; j++)
+            for (int tile_j = 0; tile_j < mass_per_col - 1; tile_j += face_tile)
             {
-                // Left upper triangle
-                faces.push_back(get_mass(i + 1, j));
-                faces.push_back(get_mass(i, j));
-                faces.push_back(get_mass(i, j + 1));
+                face_tile_begin.push_back((int)faces.size() / 3);
+                for (int i = tile_i; i < std::min(tile_i + face_tile, mass_per_row - 1); i++)
+                {
+                    for (int j = tile_j; j < std::min(tile_j + face_tile, mass_per_col - 1); j++)
+                    {
+                        // Left upper triangle
+                        faces.push_back(get_mass(i + 1, j));
+                        faces.push_back(get_mass(i, j));
+                        faces.push_back(get_mass(i, j + 1));
 
-                // Right bottom triangle
-                faces.push_back(get_mass(i + 1, j + 1));
-                faces.push_back(get_mass(i + 1, j));
-                faces.push_back(get_mass(i, j + 1));
+                        // Right bottom triangle
+                        faces.push_back(get_mass(i + 1, j + 1));
+                        faces.push_back(get_mass(i + 1, j));
+                        faces.push_back(get_mass(i, j + 1));
+                    }
+                }
             }
         }
+        face_tile_begin.push_back((int)faces.size() / 3);
     }
 
     void compute_forces()
     {
+        ProfileScope scope(profiler, ProfilePhase::Forces);
+        if (is_parallel())
+        {
+            compute_forces_parallel();
+            return;
+        }
+
+        const int n = masses.size();
+        glm::dvec3 *position = masses.position.data();
+        glm::dvec3 *velocity = masses.velocity.data();
+        glm::dvec3 *force = masses.force.data();
+        const glm::dvec3 *normal = masses.normal.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
+
         //If the force is nan, convert it to a number.
-        for (auto &mass : this->masses)
+        for (int i = 0; i < n; i++)
         {
-            if (std::isnan(mass->force.x))
+            if (std::isnan(force[i].x))
             {
-                mass->force.x = 0.0;
+                force[i].x = 0.0;
             }
-            if (std::isnan(mass->force.y))
+            if (std::isnan(force[i].y))
             {
-                mass->force.y = 0.0;
+                force[i].y = 0.0;
             }
-            if (std::isnan(mass->force.z))
+            if (std::isnan(force[i].z))
             {
-                mass->force.z = 0.0;
+                force[i].z = 0.0;
             }
         }
 
-        for (auto &spring : this->springs)
+        if (uses_membrane())
         {
-            glm::dvec3 spring_vec = spring->mass1->position - spring->mass2->position;
-            double spring_length = glm::length(spring_vec);
-
-            glm::dvec3 elastic_force = spring_vec * spring->spring_constant / spring_length * (spring_length - spring->rest_len);
-            spring->mass1->force += -elastic_force;
-            spring->mass2->force += elastic_force;
+            membrane_kernel(position, membrane, 0, membrane.size());
+            for (int i = 0; i < n; i++)
+            {
+                force[i] += membrane.gather(i);
+            }
+        }
+        else
+        {
+            const int *mass1 = springs.mass1.data();
+            const int *mass2 = springs.mass2.data();
+            const int spring_count = springs.size();
+            const double *fx = spring_force_x.data();
+            const double *fy = spring_force_y.data();
+            const double *fz = spring_force_z.data();
+            for_each_awake_spring_range(0, spring_count, [&](int begin, int end) {
+                spring_kernel(position, mass1, mass2, springs.rest_len.data(), springs.spring_constant.data(),
+                              spring_force_x.data(), spring_force_y.data(), spring_force_z.data(), begin, end);
+                for (int s = begin; s < end; s++)
+                {
+                    glm::dvec3 elastic_force(fx[s], fy[s], fz[s]);
+                    force[mass1[s]] += -elastic_force;
+                    force[mass2[s]] += elastic_force;
+                }
+            });
         }
 
-        for (auto &mass : this->masses)
+        for (int i = 0; i < n; i++)
         {
-            if (!mass->is_fixed)
+            if (!is_fixed[i])
             {
-                // damping force
-                mass->force += -mass->velocity * this->damp_coef;
+                // damping force, proportional to the area the mass stands for
+                force[i] += -velocity[i] * (this->damp_coef * masses.m[i]);
                 // gravity
-                mass->force += gravity * mass->m;
+                force[i] += gravity * masses.m[i];
                 // velo
-                glm::dvec3 relative_velocity = u_fluid - mass->velocity;
-                double velocity_normal_component = glm::dot(mass->normal, relative_velocity);
-                glm::dvec3 fluid_force = visco_coef * velocity_normal_component * mass->normal;
-                mass->force += fluid_force;
+                glm::dvec3 relative_velocity = u_fluid - velocity[i];
+                double velocity_normal_component = glm::dot(normal[i], relative_velocity);
+                glm::dvec3 fluid_force = (visco_coef * masses.m[i]) * velocity_normal_component * normal[i];
+                force[i] += fluid_force;
             }
         }
+        // Bending last, where compute_forces_parallel adds it too, so both sum in the same order
+        for_each_moving_range(0, n, [&](int begin, int end) {
+            bending.add_product(position, -bending_coef, force, begin, end);
+        });
     }
 
-    void step(bool constraint, RigidType type, void *object, double delta_t)
+    /**
+     * Same forces as compute_forces without the scattered += into both endpoints.
+     * Every spring (or triangle of the membrane) writes only its own slots, then
+     * every mass gathers its springs through the adjacency (or its corners) and
+     * its row of the bending matrix, so neither pass has data races.
+     */
+    void compute_forces_parallel()
     {
+        const glm::dvec3 *position = masses.position.data();
+        const glm::dvec3 *velocity = masses.velocity.data();
+        glm::dvec3 *force = masses.force.data();
+        const glm::dvec3 *normal = masses.normal.data();
+        const double *m = masses.m.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
+        const int *mass1 = springs.mass1.data();
+        const int *mass2 = springs.mass2.data();
+        const double *rest_len = springs.rest_len.data();
+        const double *spring_constant = springs.spring_constant.data();
+        const int *adjacency_begin = springs.adjacency_begin.data();
+        const int *adjacency = springs.adjacency.data();
+        double *fx = spring_force_x.data();
+        double *fy = spring_force_y.data();
+        double *fz = spring_force_z.data();
+
+        const bool fem = uses_membrane();
+        if (fem)
+        {
+            pool->parallel_for(0, membrane.size(), 4096, [&](int begin, int end) {
+                membrane_kernel(position, membrane, begin, end);
+            });
+        }
+        else
+        {
+            if (asleep_tiles == 0)
+            {
+                pool->parallel_for(0, springs.size(), 4096, [&](int begin, int end) {
+                    spring_kernel(position, mass1, mass2, rest_len, spring_constant, fx, fy, fz, begin, end);
+                });
+            }
+            else
+            {
+                pool->parallel_for(0, (int)awake_springs.size(), 1, [&](int begin, int end) {
+                    for (int r = begin; r < end; r++)
+                    {
+                        spring_kernel(position, mass1, mass2, rest_len, spring_constant, fx, fy, fz, awake_springs[r].x, awake_springs[r].y);
+                    }
+                });
+            }
+        }
+
+        pool->parallel_for(0, masses.size(), 2048, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                if (is_fixed[i])
+                {
+                    // Pinned or asleep, nothing moves it
+                    continue;
+                }
+                //If the force is nan, convert it to a number.
+                glm::dvec3 f = force[i];
+                if (std::isnan(f.x))
+                {
+                    f.x = 0.0;
+                }
+                if (std::isnan(f.y))
+                {
+                    f.y = 0.0;
+                }
+                if (std::isnan(f.z))
+                {
+                    f.z = 0.0;
+                }
+
+                if (fem)
+                {
+                    f += membrane.gather(i);
+                }
+                for (int a = adjacency_begin[i]; !fem && a < adjacency_begin[i + 1]; a++)
+                {
+                    int s = adjacency[a];
+                    if (s >= 0)
+                    {
+                        f -= glm::dvec3(fx[s], fy[s], fz[s]);
+                    }
+                    else
+                    {
+                        f += glm::dvec3(fx[~s], fy[~s], fz[~s]);
+                    }
+                }
+
+                if (!is_fixed[i])
+                {
+                    // damping force, proportional to the area the mass stands for
+                    f += -velocity[i] * (this->damp_coef * m[i]);
+                    // gravity
+                    f += gravity * m[i];
+                    // velo
+                    glm::dvec3 relative_velocity = u_fluid - velocity[i];
+                    double velocity_normal_component = glm::dot(normal[i], relative_velocity);
+                    f += (visco_coef * m[i]) * velocity_normal_component * normal[i];
+                }
+                force[i] = f;
+            }
+            for_each_moving_range(begin, end, [&](int run_begin, int run_end) {
+                bending.add_product(position, -bending_coef, force, run_begin, run_end);
+            });
+        });
+    }
+
+    void step(bool constraint, const ColliderScene *scene, double delta_t)
+    {
+        TraceScope trace("Euler step");
+        if (wake_sleeping(scene))
+        {
+            return;
+        }
         compute_forces();
 
-        for (auto &mass : this->masses)
+        const int n = masses.size();
+        glm::dvec3 *position = masses.position.data();
+        glm::dvec3 *last_position = masses.last_position.data();
+        glm::dvec3 *velocity = masses.velocity.data();
+        glm::dvec3 *force = masses.force.data();
+        const double *inv_m = masses.inv_m.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
         {
-            if (!mass->is_fixed)
+            ProfileScope scope(profiler, ProfilePhase::Integration);
+            for (int i = 0; i < n; i++)
             {
-                mass->last_position = mass->position;
-                mass->velocity += mass->force / mass->m * delta_t;
-                mass->position += mass->velocity * delta_t;
+                if (!is_fixed[i])
+                {
+                    last_position[i] = position[i];
+                    velocity[i] += force[i] * inv_m[i] * delta_t;
+                    position[i] += velocity[i] * delta_t;
+                }
+                force[i] = glm::dvec3(0.0, 0.0, 0.0);
             }
-            mass->force = glm::dvec3(0.0, 0.0, 0.0);
         }
         if (constraint)
         {
             solve_constraints(constraints_iterations);
             update_velocity_after_constraints(delta_t);
         }
-        collisionResponse(type, object);
+        collisionResponse(scene);
+        update_sleeping(delta_t);
     }
 
     /**
      * Runge Kutta
+     * The stages share four persistent buffers: the state at the start of the
+     * step and the running weighted sums of the position and velocity slopes.
+     * Each stage makes one pass that takes its slopes from the fresh forces,
+     * adds them to the sums and moves the masses to the next stage point.
      */
-    void rk4_step(bool constraint, RigidType type, void *object, double delta_t)
-    {
-        std::vector<glm::dvec3> initial_positions;
-        std::vector<glm::dvec3> initial_velocities;
-        std::vector<glm::dvec3> k1_positions;
-        std::vector<glm::dvec3> k1_velocities;
-        std::vector<glm::dvec3> k2_positions;
-        std::vector<glm::dvec3> k2_velocities;
-        std::vector<glm::dvec3> k3_positions;
-        std::vector<glm::dvec3> k3_velocities;
-        std::vector<glm::dvec3> k4_positions;
-        std::vector<glm::dvec3> k4_velocities;
-
-        for (auto &mass : masses)
-        {
-            mass->last_position = mass->position;
-            initial_positions.push_back(mass->position);
-            initial_velocities.push_back(mass->velocity);
-            k1_positions.push_back(glm::dvec3(0.0));
-            k1_velocities.push_back(glm::dvec3(0.0));
-            k2_positions.push_back(glm::dvec3(0.0));
-            k2_velocities.push_back(glm::dvec3(0.0));
-            k3_positions.push_back(glm::dvec3(0.0));
-            k3_velocities.push_back(glm::dvec3(0.0));
-            k4_positions.push_back(glm::dvec3(0.0));
-            k4_velocities.push_back(glm::dvec3(0.0));
-        }
-
-        // k1
+    void rk4_step(bool constraint, const ColliderScene *scene, double delta_t)
+    {
+        TraceScope trace("RK4 step");
+        if (wake_sleeping(scene))
+        {
+            return;
+        }
+        const int n = masses.size();
+        rk4_initial_position.resize(n);
+        rk4_initial_velocity.resize(n);
+        rk4_position_sum.resize(n);
+        rk4_velocity_sum.resize(n);
+
+        compute_forces();
+        rk4_stage(0, delta_t);
         compute_forces();
-        for (size_t i = 0; i < masses.size(); ++i)
+        rk4_stage(1, delta_t);
+        compute_forces();
+        rk4_stage(2, delta_t);
+        compute_forces();
+        rk4_stage(3, delta_t);
+
+        if (constraint)
         {
-            if (!masses[i]->is_fixed)
+            solve_constraints(constraints_iterations);
+            update_velocity_after_constraints(delta_t);
+        }
+        collisionResponse(scene);
+        update_sleeping(delta_t);
+    }
+
+    // Slopes k = (v dt, f / m dt) of one stage, combined as (k1 + 2 k2 + 2 k3 + k4) / 6
+    void rk4_stage(int stage, double delta_t)
+    {
+        ProfileScope scope(profiler, ProfilePhase::Integration);
+        glm::dvec3 *position = masses.position.data();
+        glm::dvec3 *last_position = masses.last_position.data();
+        glm::dvec3 *velocity = masses.velocity.data();
+        glm::dvec3 *force = masses.force.data();
+        const double *inv_m = masses.inv_m.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
+        glm::dvec3 *initial_position = rk4_initial_position.data();
+        glm::dvec3 *initial_velocity = rk4_initial_velocity.data();
+        glm::dvec3 *position_sum = rk4_position_sum.data();
+        glm::dvec3 *velocity_sum = rk4_velocity_sum.data();
+
+        parallel_for(pool, 0, masses.size(), 2048, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
             {
-                k1_positions[i] = masses[i]->velocity * delta_t;
-                k1_velocities[i] = masses[i]->force / masses[i]->m * delta_t;
+                if (stage == 0)
+                {
+                    last_position[i] = position[i];
+                }
+                if (!is_fixed[i])
+                {
+                    glm::dvec3 k_position = velocity[i] * delta_t;
+                    glm::dvec3 k_velocity = force[i] * inv_m[i] * delta_t;
+                    switch (stage)
+                    {
+                    case 0:
+                        initial_position[i] = position[i];
+                        initial_velocity[i] = velocity[i];
+                        position_sum[i] = k_position;
+                        velocity_sum[i] = k_velocity;
+                        position[i] = initial_position[i] + 0.5 * k_position;
+                        velocity[i] = initial_velocity[i] + 0.5 * k_velocity;
+                        break;
+                    case 1:
+                        position_sum[i] += 2.0 * k_position;
+                        velocity_sum[i] += 2.0 * k_velocity;
+                        position[i] = initial_position[i] + 0.5 * k_position;
+                        velocity[i] = initial_velocity[i] + 0.5 * k_velocity;
+                        break;
+                    case 2:
+                        position_sum[i] += 2.0 * k_position;
+                        velocity_sum[i] += 2.0 * k_velocity;
+                        position[i] = initial_position[i] + k_position;
+                        velocity[i] = initial_velocity[i] + k_velocity;
+                        break;
+                    default:
+                        position[i] = initial_position[i] + (position_sum[i] + k_position) / 6.0;
+                        velocity[i] = initial_velocity[i] + (velocity_sum[i] + k_velocity) / 6.0;
+                        break;
+                    }
+                }
+                if (stage == 3)
+                {
+                    force[i] = glm::dvec3(0.0); // Reset force for the next timestep
+                }
             }
+        });
+    }
+
+    /**
+     * Adaptive Runge Kutta: Dormand-Prince 5(4) steps (Dormand and Prince, "A
+     * family of embedded Runge-Kutta formulae") that cover delta_t with as few
+     * force evaluations as the error allows. Every step compares its fifth
+     * order result with the embedded fourth order one; a step whose largest
+     * difference exceeds rk45_tolerance is retaken shorter, and the next step
+     * grows or shrinks with (1 / error)^(1/5). The step size carries over from
+     * one call to the next, so a calm cloth keeps taking long steps and a
+     * whipped one short ones. Constraints and collisions follow every accepted
+     * step, as they follow every rk4_step. Forces applied before the call act
+     * during the first step.
+     */
+    void rk45_step(bool constraint, const ColliderScene *scene, double delta_t)
+    {
+        TraceScope trace("RK45 step");
+        if (wake_sleeping(scene))
+        {
+            return;
         }
+        const int n = masses.size();
+        rk4_initial_position.resize(n);
+        rk4_initial_velocity.resize(n);
+        for (int stage = 0; stage < 7; stage++)
+        {
+            rk45_velocity[stage].resize(n);
+            rk45_acceleration[stage].resize(n);
+        }
+        rk45_applied_force = masses.force;
 
-        // k2
-        for (size_t i = 0; i < masses.size(); ++i)
+        double time = 0.0;
+        bool first = true;
+        while (true)
         {
-            if (!masses[i]->is_fixed)
+            const double remaining = delta_t - time;
+            const bool clamped = rk45_delta_t >= remaining;
+            double h = clamped ? remaining : rk45_delta_t;
+            if (!clamped && 2.0 * h > remaining)
             {
-                masses[i]->position = initial_positions[i] + 0.5 * k1_positions[i];
-                masses[i]->velocity = initial_velocities[i] + 0.5 * k1_velocities[i];
+                // Two halves instead of a full step and a sliver
+                h = 0.5 * remaining;
             }
-        }
-        compute_forces();
-        for (size_t i = 0; i < masses.size(); ++i)
-        {
-            if (!masses[i]->is_fixed)
+            double error = 0.0;
+            for (int stage = 0; stage < 7; stage++)
             {
-                k2_positions[i] = masses[i]->velocity * delta_t;
-                k2_velocities[i] = masses[i]->force / masses[i]->m * delta_t;
+                compute_forces();
+                error = rk45_stage(stage, h);
+            }
+            const double factor = std::min(5.0, std::max(0.2, 0.9 * std::pow(std::max(error, 1e-10), -0.2)));
+            if (error > 1.0)
+            {
+                rk45_rejected++;
+                rk45_delta_t = h * std::min(factor, 0.9);
+                masses.position = rk4_initial_position;
+                masses.velocity = rk4_initial_velocity;
+                continue;
             }
-        }
 
-        // k3
-        for (size_t i = 0; i < masses.size(); ++i)
-        {
-            if (!masses[i]->is_fixed)
+            rk45_accepted++;
+            if (!clamped || factor < 1.0)
             {
-                masses[i]->position = initial_positions[i] + 0.5 * k2_positions[i];
-                masses[i]->velocity = initial_velocities[i] + 0.5 * k2_velocities[i];
+                rk45_delta_t = h * factor;
             }
-        }
-        compute_forces();
-        for (size_t i = 0; i < masses.size(); ++i)
-        {
-            if (!masses[i]->is_fixed)
+            if (first)
             {
-                k3_positions[i] = masses[i]->velocity * delta_t;
-                k3_velocities[i] = masses[i]->force / masses[i]->m * delta_t;
+                first = false;
+                std::fill(rk45_applied_force.begin(), rk45_applied_force.end(), glm::dvec3(0.0));
+                std::fill(masses.force.begin(), masses.force.end(), glm::dvec3(0.0));
             }
+            if (constraint)
+            {
+                solve_constraints(constraints_iterations);
+                update_velocity_after_constraints(h);
+            }
+            collisionResponse(scene);
+            update_sleeping(h);
+            if (clamped)
+            {
+                break;
+            }
+            time += h;
         }
+    }
+
+    /**
+     * Keep the slopes (v, f / m) of one stage and move the masses to the next
+     * stage point; after stage 5 that is the fifth order result. Stage 6 only
+     * returns the error of the step, the largest position difference to the
+     * fourth order result relative to rk45_tolerance rest spacings. Velocities
+     * are left out: the constraints replace them after the step, and without
+     * constraints their error shows up in the positions of the next step.
+     */
+    double rk45_stage(int stage, double delta_t)
+    {
+        static constexpr double a[6][6] = {
+            {1.0 / 5.0},
+            {3.0 / 40.0, 9.0 / 40.0},
+            {44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0},
+            {19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0},
+            {9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0},
+            {35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0}};
+        // Fifth minus fourth order weights
+        static constexpr double e[7] = {71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0};
 
-        // k4
-        for (size_t i = 0; i < masses.size(); ++i)
+        ProfileScope scope(profiler, ProfilePhase::Integration);
+        glm::dvec3 *position = masses.position.data();
+        glm::dvec3 *last_position = masses.last_position.data();
+        glm::dvec3 *velocity = masses.velocity.data();
+        glm::dvec3 *force = masses.force.data();
+        const double *inv_m = masses.inv_m.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
+        const glm::dvec3 *applied_force = rk45_applied_force.data();
+        glm::dvec3 *initial_position = rk4_initial_position.data();
+        glm::dvec3 *initial_velocity = rk4_initial_velocity.data();
+        glm::dvec3 *k_velocity[7];
+        glm::dvec3 *k_acceleration[7];
+        for (int j = 0; j < 7; j++)
         {
-            if (!masses[i]->is_fixed)
+            k_velocity[j] = rk45_velocity[j].data();
+            k_acceleration[j] = rk45_acceleration[j].data();
+        }
+        const double position_tolerance = rk45_tolerance / std::max(row_density, col_density);
+        std::atomic<double> error(0.0);
+
+        parallel_for(pool, 0, masses.size(), 2048, [&](int begin, int end) {
+            double chunk_error = 0.0;
+            for (int i = begin; i < end; i++)
+            {
+                if (stage == 0)
+                {
+                    last_position[i] = position[i];
+                    initial_position[i] = position[i];
+                    initial_velocity[i] = velocity[i];
+                }
+                if (!is_fixed[i])
+                {
+                    k_velocity[stage][i] = velocity[i];
+                    k_acceleration[stage][i] = force[i] * inv_m[i];
+                    if (stage < 6)
+                    {
+                        glm::dvec3 dx(0.0), dv(0.0);
+                        for (int j = 0; j <= stage; j++)
+                        {
+                            dx += a[stage][j] * k_velocity[j][i];
+                            dv += a[stage][j] * k_acceleration[j][i];
+                        }
+                        position[i] = initial_position[i] + dx * delta_t;
+                        velocity[i] = initial_velocity[i] + dv * delta_t;
+                    }
+                    else
+                    {
+                        glm::dvec3 ex(0.0), ev(0.0);
+                        for (int j = 0; j < 7; j++)
+                        {
+                            ex += e[j] * k_velocity[j][i];
+                            ev += e[j] * k_acceleration[j][i];
+                        }
+                        chunk_error = std::max(chunk_error, glm::length(ex) * delta_t / position_tolerance);
+                    }
+                }
+                force[i] = applied_force[i];
+            }
+
+            double seen = error.load(std::memory_order_relaxed);
+            while (chunk_error > seen && !error.compare_exchange_weak(seen, chunk_error, std::memory_order_relaxed))
             {
-                masses[i]->position = initial_positions[i] + k3_positions[i];
-                masses[i]->velocity = initial_velocities[i] + k3_velocities[i];
             }
+        });
+        return error.load(std::memory_order_relaxed);
+    }
+
+    void explicit_verlet(bool constraint, const ColliderScene *scene, double delta_t)
+    {
+        TraceScope trace("Verlet step");
+        if (wake_sleeping(scene))
+        {
+            return;
         }
         compute_forces();
-        for (size_t i = 0; i < masses.size(); ++i)
+
+        const int n = masses.size();
+        glm::dvec3 *position = masses.position.data();
+        glm::dvec3 *last_position = masses.last_position.data();
+        glm::dvec3 *force = masses.force.data();
+        const double *inv_m = masses.inv_m.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
         {
-            if (!masses[i]->is_fixed)
+            ProfileScope scope(profiler, ProfilePhase::Integration);
+            for (int i = 0; i < n; i++)
             {
-                k4_positions[i] = masses[i]->velocity * delta_t;
-                k4_velocities[i] = masses[i]->force / masses[i]->m * delta_t;
+                if (!is_fixed[i])
+                {
+                    glm::dvec3 a = force[i] * inv_m[i] + gravity;
+                    auto temp = position[i];
+                    position[i] += (1.0 - damp_coef) * (position[i] - last_position[i]) + a * delta_t * delta_t * 10.0;
+                    last_position[i] = temp;
+                }
+                force[i] = glm::dvec3(0.0, 0.0, 0.0);
             }
         }
+        if (constraint)
+        {
+            solve_constraints(0);
+            update_velocity_after_constraints(delta_t);
+        }
+        collisionResponse(scene);
+        update_sleeping(delta_t);
+    }
+
+    /**
+     * Extended Position Based Dynamics (Macklin et al., "XPBD: Position-Based
+     * Simulation of Compliant Constrained Dynamics"). Every spring is a distance
+     * constraint with compliance 1 / spring_constant and every bending stencil
+     * the linear constraint sum_i w_i x_i = 0 with compliance 1 / bending_coef,
+     * so the stiffness no longer depends on the iteration count or step size.
+     * Gravity, damping, drag and applied forces predict the positions, then
+     * xpbd_iterations Gauss-Seidel sweeps over the spring and stencil colors
+     * project them.
+     */
+    void xpbd_step(bool constraint, const ColliderScene *scene, double delta_t)
+    {
+        TraceScope trace("XPBD step");
+        if (wake_sleeping(scene))
+        {
+            return;
+        }
+        const int n = masses.size();
+        glm::dvec3 *position = masses.position.data();
+        glm::dvec3 *last_position = masses.last_position.data();
+        glm::dvec3 *velocity = masses.velocity.data();
+        glm::dvec3 *force = masses.force.data();
+        const glm::dvec3 *normal = masses.normal.data();
+        const double *m = masses.m.data();
+        const double *inv_m = masses.inv_m.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
+
+        {
+            ProfileScope scope(profiler, ProfilePhase::Integration);
+            parallel_for(pool, 0, n, 2048, [&](int begin, int end) {
+                for (int i = begin; i < end; i++)
+                {
+                    if (!is_fixed[i])
+                    {
+                        glm::dvec3 f = force[i] + gravity * m[i] - velocity[i] * (damp_coef * m[i]);
+                        f += (visco_coef * m[i]) * glm::dot(normal[i], u_fluid - velocity[i]) * normal[i];
+                        last_position[i] = position[i];
+                        velocity[i] += f * inv_m[i] * delta_t;
+                        position[i] += velocity[i] * delta_t;
+                    }
+                    force[i] = glm::dvec3(0.0, 0.0, 0.0);
+                }
+            });
+        }
 
-        // Combine
-        for (size_t i = 0; i < masses.size(); ++i)
+        const int *mass1 = springs.mass1.data();
+        const int *mass2 = springs.mass2.data();
+        const double *rest_len = springs.rest_len.data();
+        const double *spring_constant = springs.spring_constant.data();
+        xpbd_lambda.assign(springs.size(), 0.0);
+        double *lambda = xpbd_lambda.data();
+        const double inv_dt2 = 1.0 / (delta_t * delta_t);
+        const glm::ivec4 *stencil_mass = bending.stencil_mass.data();
+        const glm::dvec4 *stencil_weight = bending.stencil_weight.data();
+        xpbd_bending_lambda.assign(bending.size(), glm::dvec3(0.0));
+        glm::dvec3 *bending_lambda = xpbd_bending_lambda.data();
+        const double alpha_bending = inv_dt2 / bending_coef;
+        const int bending_colors = bending_coef > 0.0 ? bending.color_count() : 0;
         {
-            if (!masses[i]->is_fixed)
+            ProfileScope scope(profiler, ProfilePhase::Constraints);
+            for (int iteration = 0; iteration < xpbd_iterations; iteration++)
             {
-                masses[i]->position = initial_positions[i] + (k1_positions[i] + 2.0 * k2_positions[i] + 2.0 * k3_positions[i] + k4_positions[i]) / 6.0;
-                masses[i]->velocity = initial_velocities[i] + (k1_velocities[i] + 2.0 * k2_velocities[i] + 2.0 * k3_velocities[i] + k4_velocities[i]) / 6.0;
+                // Springs of one color share no mass, so the result does not depend on the pool
+                for (int c = 0; c < springs.color_count(); c++)
+                {
+                    parallel_for(pool, springs.color_begin[c], springs.color_begin[c + 1], 1024, [&](int begin, int end) {
+                        for (int s = begin; s < end; s++)
+                        {
+                            double w1 = inv_m[mass1[s]];
+                            double w2 = inv_m[mass2[s]];
+                            glm::dvec3 spring_vec = position[mass2[s]] - position[mass1[s]];
+                            double current_length = glm::length(spring_vec);
+                            if (w1 + w2 == 0.0 || current_length == 0.0)
+                            {
+                                continue;
+                            }
+
+                            double alpha = inv_dt2 / spring_constant[s];
+                            double delta_lambda = (rest_len[s] - current_length - alpha * lambda[s]) / (w1 + w2 + alpha);
+                            lambda[s] += delta_lambda;
+                            glm::dvec3 correction = spring_vec * (delta_lambda / current_length);
+                            position[mass1[s]] -= correction * w1;
+                            position[mass2[s]] += correction * w2;
+                        }
+                    });
+                }
+                // The bending constraint is linear, its gradient at mass i is w_i
+                for (int c = 0; c < bending_colors; c++)
+                {
+                    parallel_for(pool, bending.color_begin[c], bending.color_begin[c + 1], 1024, [&](int begin, int end) {
+                        for (int s = begin; s < end; s++)
+                        {
+                            const glm::ivec4 &stencil = stencil_mass[s];
+                            const glm::dvec4 &w = stencil_weight[s];
+                            glm::dvec3 value(0.0);
+                            double denominator = alpha_bending;
+                            for (int k = 0; k < 4; k++)
+                            {
+                                value += w[k] * position[stencil[k]];
+                                denominator += inv_m[stencil[k]] * w[k] * w[k];
+                            }
+                            glm::dvec3 delta_lambda = (-value - alpha_bending * bending_lambda[s]) / denominator;
+                            bending_lambda[s] += delta_lambda;
+                            for (int k = 0; k < 4; k++)
+                            {
+                                position[stencil[k]] += (inv_m[stencil[k]] * w[k]) * delta_lambda;
+                            }
+                        }
+                    });
+                }
             }
-            masses[i]->force = glm::dvec3(0.0); // Reset force for the next timestep
         }
 
         if (constraint)
         {
             solve_constraints(constraints_iterations);
-            update_velocity_after_constraints(delta_t);
         }
-        collisionResponse(type, object);
+        update_velocity_after_constraints(delta_t);
+        collisionResponse(scene);
+        update_sleeping(delta_t);
     }
 
-    void explicit_verlet(bool constraint, RigidType type, void *object, double delta_t)
+    /**
+     * Backward Euler after Baraff & Witkin, "Large Steps in Cloth Simulation".
+     * Solves (M - h df/dv - h^2 df/dx) dv = h (f + h df/dx v) with one linearised
+     * Newton step, so the step size is no longer bound by the spring stiffness.
+     * The spring Jacobian drops the compressive part of the geometric stiffness
+     * to keep the system positive definite; fixed masses are filtered out of the
+     * solve. Positions and velocities then advance like the other integrators.
+     */
+    void implicit_step(bool constraint, const ColliderScene *scene, double delta_t)
     {
+        TraceScope trace("implicit step");
+        if (wake_sleeping(scene))
+        {
+            return;
+        }
         compute_forces();
-
-        for (auto &mass : this->masses)
         {
-            if (!mass->is_fixed)
-            {
-                glm::dvec3 a = mass->force / mass->m + gravity;
-                auto temp = mass->position;
-                mass->position += (1.0 - damp_coef) * (mass->position - mass->last_position) + a * delta_t * delta_t * 10.0;
-                mass->last_position = temp;
-            }
-            mass->force = glm::dvec3(0.0, 0.0, 0.0);
+            ProfileScope scope(profiler, ProfilePhase::Integration);
+            assemble_implicit_system(delta_t);
+
+            const int n = masses.size();
+            const unsigned char *is_fixed = masses.is_fixed.data();
+            implicit_solver.solve(implicit_matrix, springs, is_fixed, implicit_rhs.data(), implicit_dv.data(),
+                                  implicit_tolerance, implicit_iterations, pool);
+
+            glm::dvec3 *position = masses.position.data();
+            glm::dvec3 *last_position = masses.last_position.data();
+            glm::dvec3 *velocity = masses.velocity.data();
+            glm::dvec3 *force = masses.force.data();
+            const glm::dvec3 *dv = implicit_dv.data();
+            parallel_for(pool, 0, n, 2048, [&](int begin, int end) {
+                for (int i = begin; i < end; i++)
+                {
+                    if (!is_fixed[i])
+                    {
+                        last_position[i] = position[i];
+                        velocity[i] += dv[i];
+                        position[i] += velocity[i] * delta_t;
+                    }
+                    force[i] = glm::dvec3(0.0, 0.0, 0.0);
+                }
+            });
         }
         if (constraint)
         {
-            solve_constraints(0);
+            solve_constraints(constraints_iterations);
             update_velocity_after_constraints(delta_t);
         }
-        collisionResponse(type, object);
+        collisionResponse(scene);
+        update_sleeping(delta_t);
     }
 
-    void solve_constraints(int iterations)
+    /**
+     * Fill implicit_matrix and implicit_rhs for a step of delta_t from the current
+     * forces. Every spring contributes h^2 K to its off-diagonal block, where
+     * K = -k (u u^T + max(0, 1 - rest_len / len) (I - u u^T)) is df1/dx1, the
+     * force on mass1 by its own position (so df1/dx2 = -K), and -h^2 K to the
+     * diagonal blocks of both ends.
+     * Bending adds the constant h^2 bending_coef Q, its diagonal to the blocks
+     * and the rest through the bending rows of the matrix. With the membrane the
+     * off-diagonal block of a spring is instead the sum of the membrane stiffness
+     * of the triangle edges along it; blocks of springs along no edge stay zero.
+     */
+    void assemble_implicit_system(double delta_t)
     {
-        for (int i = 0; i < this->constraints_iterations; i++)
+        const int n = masses.size();
+        const double h2 = delta_t * delta_t;
+        implicit_matrix.resize(n, springs.size());
+        implicit_rhs.resize(n);
+        implicit_dv.resize(n);
+
+        const glm::dvec3 *position = masses.position.data();
+        const glm::dvec3 *velocity = masses.velocity.data();
+        const glm::dvec3 *force = masses.force.data();
+        const glm::dvec3 *normal = masses.normal.data();
+        const double *m = masses.m.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
+        const int *mass1 = springs.mass1.data();
+        const int *mass2 = springs.mass2.data();
+        const double *rest_len = springs.rest_len.data();
+        const double *spring_constant = springs.spring_constant.data();
+        const int *adjacency_begin = springs.adjacency_begin.data();
+        const int *adjacency = springs.adjacency.data();
+        glm::dmat3 *off_diagonal = implicit_matrix.off_diagonal.data();
+        const double bending_scale = h2 * bending_coef;
+        const int *bending_row_begin = bending.row_begin.data();
+        const int *bending_column = bending.column.data();
+        const double *bending_weight = bending.weight.data();
+        implicit_matrix.bending = &bending;
+        implicit_matrix.bending_scale = bending_scale;
+
+        if (uses_membrane())
         {
-            bool normal = true;
-            for (auto &spring : springs)
+            parallel_for(pool, 0, membrane.size(), 2048, [&](int begin, int end) {
+                membrane.stiffness_blocks(position, h2, begin, end);
+            });
+            parallel_for(pool, 0, springs.size(), 4096, [&](int begin, int end) {
+                for (int s = begin; s < end; s++)
+                {
+                    off_diagonal[s] = membrane.spring_block(s);
+                }
+            });
+        }
+        else
+        {
+            parallel_for(pool, 0, springs.size(), 4096, [&](int begin, int end) {
+                for (int s = begin; s < end; s++)
+                {
+                    glm::dvec3 spring_vec = position[mass1[s]] - position[mass2[s]];
+                    double spring_length = glm::length(spring_vec);
+                    glm::dvec3 u = spring_vec / spring_length;
+                    glm::dmat3 uu = glm::outerProduct(u, u);
+                    double geometric = std::max(0.0, 1.0 - rest_len[s] / spring_length);
+                    off_diagonal[s] = (-spring_constant[s] * h2) * (uu + geometric * (glm::dmat3(1.0) - uu));
+                }
+            });
+        }
+
+        parallel_for(pool, 0, n, 2048, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
             {
-                // skip the flexion spring(almost not limited in real cloth)
-                if (spring->spring_type == Spring::FLEXION)
+                if (is_fixed[i])
                 {
+                    implicit_matrix.diagonal[i] = glm::dmat3(1.0);
+                    implicit_matrix.diagonal_inverse[i] = glm::dmat3(1.0);
+                    implicit_rhs[i] = glm::dvec3(0.0);
                     continue;
                 }
-                // skip the flexion springs and shear springs
-                // if (spring->spring_type == Spring::FLEXION || spring->spring_type == Spring::SHEAR)
-                // {
-                //     continue;
-                // }
-                double current_length = spring->get_length();
-                if (current_length <= spring->max_len)
+
+                // Mass, damping and the normal drag of the fluid force, all implicit in v
+                glm::dmat3 a = glm::dmat3(m[i] * (1.0 + delta_t * damp_coef)) +
+                               (delta_t * visco_coef * m[i]) * glm::outerProduct(normal[i], normal[i]);
+                // b = h f + h^2 sum K (v_i - v_other), fixed masses do not move
+                glm::dvec3 b = force[i] * delta_t;
+                for (int j = adjacency_begin[i]; j < adjacency_begin[i + 1]; j++)
                 {
-                    continue;
+                    int s = adjacency[j];
+                    int other = s >= 0 ? mass2[s] : mass1[~s];
+                    const glm::dmat3 block = s >= 0 ? off_diagonal[s] : glm::transpose(off_diagonal[~s]);
+                    a -= block;
+                    b += block * (velocity[i] - (is_fixed[other] ? glm::dvec3(0.0) : velocity[other]));
                 }
-                if (spring->mass1->is_fixed && spring->mass2->is_fixed)
+                a += glm::dmat3(bending_scale * bending.diagonal[i]);
+                glm::dvec3 bending_velocity = bending.diagonal[i] * velocity[i];
+                for (int j = bending_row_begin[i]; j < bending_row_begin[i + 1]; j++)
                 {
-                    continue;
+                    if (!is_fixed[bending_column[j]])
+                    {
+                        bending_velocity += bending_weight[j] * velocity[bending_column[j]];
+                    }
                 }
+                b -= bending_scale * bending_velocity;
+                implicit_matrix.diagonal[i] = a;
+                implicit_matrix.diagonal_inverse[i] = glm::inverse(a);
+                implicit_rhs[i] = b;
+            }
+        });
+    }
 
-                glm::dvec3 direction = (spring->mass2->position - spring->mass1->position) / current_length;
-                double delta = current_length - spring->max_len;
-                double mass_sum = (spring->mass1->is_fixed ? 0.0 : 1.0) + (spring->mass2->is_fixed ? 0.0 : 1.0);
-                double correction = delta / mass_sum;
+    void solve_constraints(int iterations)
+    {
+        ProfileScope scope(profiler, ProfilePhase::Constraints);
+        if (is_parallel())
+        {
+            solve_constraints_parallel();
+            return;
+        }
 
-                if (!spring->mass1->is_fixed)
+        glm::dvec3 *position = masses.position.data();
+        const double *inv_m = masses.inv_m.data();
+        const int *mass1 = springs.mass1.data();
+        const int *mass2 = springs.mass2.data();
+        const double *max_len = springs.max_len.data();
+        const int constraint_begin = springs.begin(Spring::STRUCTURAL);
+        const int constraint_end = springs.end(Spring::SHEAR);
+        // skip the shear springs
+        // const int constraint_end = springs.end(Spring::STRUCTURAL);
+        for (int i = 0; i < this->constraints_iterations; i++)
+        {
+            bool normal = true;
+            for (int s = constraint_begin; s < constraint_end; s++)
+            {
+                // Fixed and sleeping masses have zero inverse mass
+                double w1 = inv_m[mass1[s]];
+                double w2 = inv_m[mass2[s]];
+                double mass_sum = w1 + w2;
+                if (mass_sum == 0.0)
                 {
-                    spring->mass1->position += direction * correction;
-                    normal = false;
+                    continue;
                 }
-                if (!spring->mass2->is_fixed)
+                glm::dvec3 spring_vec = position[mass2[s]] - position[mass1[s]];
+                double current_length = glm::length(spring_vec);
+                if (current_length <= max_len[s])
                 {
-                    spring->mass2->position -= direction * correction;
-                    normal = false;
+                    continue;
                 }
+
+                glm::dvec3 direction = spring_vec / current_length;
+                double delta = current_length - max_len[s];
+                double correction = delta / mass_sum;
+
+                position[mass1[s]] += direction * (correction * w1);
+                position[mass2[s]] -= direction * (correction * w2);
+                normal = false;
             }
             if (normal)
             {
@@ -395,229 +1223,448 @@ public:
         }
     }
 
-    void update_velocity_after_constraints(double delta_t)
+    /**
+     * Gauss-Seidel over the colors, Jacobi-free inside a color: springs of one
+     * color share no mass, so each color is projected by all threads at once.
+     * Returns the number of sweeps and stops early once the largest relative
+     * overstretch seen during a sweep is within constraints_tolerance.
+     */
+    int solve_constraints_parallel()
     {
-        for (auto &mass : masses)
+        glm::dvec3 *position = masses.position.data();
+        const double *inv_m = masses.inv_m.data();
+        const int *mass1 = springs.mass1.data();
+        const int *mass2 = springs.mass2.data();
+        const double *max_len = springs.max_len.data();
+        const int constraint_begin = springs.begin(Spring::STRUCTURAL);
+        const int constraint_end = springs.end(Spring::SHEAR);
+
+        int i = 0;
+        while (i < this->constraints_iterations)
         {
-            mass->velocity = (mass->position - mass->last_position) / delta_t;
+            std::atomic<double> residual(0.0);
+            for (int c = 0; c < springs.color_count(); c++)
+            {
+                if (springs.color_begin[c] < constraint_begin || springs.color_begin[c + 1] > constraint_end)
+                {
+                    continue;
+                }
+                pool->parallel_for(springs.color_begin[c], springs.color_begin[c + 1], 1024, [&](int begin, int end) {
+                    double chunk_residual = 0.0;
+                    for (int s = begin; s < end; s++)
+                    {
+                        double w1 = inv_m[mass1[s]];
+                        double w2 = inv_m[mass2[s]];
+                        double mass_sum = w1 + w2;
+                        if (mass_sum == 0.0)
+                        {
+                            continue;
+                        }
+                        glm::dvec3 spring_vec = position[mass2[s]] - position[mass1[s]];
+                        double current_length = glm::length(spring_vec);
+                        if (current_length <= max_len[s])
+                        {
+                            continue;
+                        }
+
+                        double delta = current_length - max_len[s];
+                        chunk_residual = std::max(chunk_residual, delta / max_len[s]);
+                        glm::dvec3 direction = spring_vec / current_length;
+                        double correction = delta / mass_sum;
+
+                        position[mass1[s]] += direction * (correction * w1);
+                        position[mass2[s]] -= direction * (correction * w2);
+                    }
+
+                    double seen = residual.load(std::memory_order_relaxed);
+                    while (chunk_residual > seen && !residual.compare_exchange_weak(seen, chunk_residual, std::memory_order_relaxed))
+                    {
+                    }
+                });
+            }
+            i++;
+            if (residual.load(std::memory_order_relaxed) <= constraints_tolerance)
+            {
+                break;
+            }
         }
+        return i;
     }
 
-    void compute_normal()
+    void update_velocity_after_constraints(double delta_t)
     {
-        for (int i = 0; i < faces.size() / 3; i++)
+        ProfileScope scope(profiler, ProfilePhase::VelocityUpdate);
+        const int n = masses.size();
+        const glm::dvec3 *position = masses.position.data();
+        const glm::dvec3 *last_position = masses.last_position.data();
+        glm::dvec3 *velocity = masses.velocity.data();
+        for (int i = 0; i < n; i++)
         {
-            Mass *m1 = faces[3 * i + 0];
-            Mass *m2 = faces[3 * i + 1];
-            Mass *m3 = faces[3 * i + 2];
-
-            glm::dvec3 normal = glm::cross(m2->position - m1->position, m3->position - m1->position);
-            normal = glm::normalize(normal);
-            m1->normal = normal;
-            m2->normal = normal;
-            m3->normal = normal;
+            velocity[i] = (position[i] - last_position[i]) / delta_t;
         }
     }
 
+    /**
+     * Area-weighted vertex normals, read straight off the grid: the normal of a
+     * mass is the normalized sum of the cross products of the up to six
+     * triangles around it. Every mass only writes its own normal, so rows run
+     * in parallel and the result does not depend on the thread count.
+     */
+    void compute_normal()
+    {
+        ProfileScope scope(profiler, ProfilePhase::Normals);
+        const glm::dvec3 *position = masses.position.data();
+        glm::dvec3 *normal = masses.normal.data();
+        const int row_length = mass_per_row;
+        parallel_for(pool, 0, mass_per_col, std::max(1, 2048 / row_length), [&](int begin, int end) {
+            for (int j = begin; j < end; j++)
+            {
+                const glm::dvec3 *row = position + j * row_length;
+                glm::dvec3 *row_normal = normal + j * row_length;
+                if (j == 0 || j == mass_per_col - 1 || row_length < 3)
+                {
+                    for (int i = 0; i < row_length; i++)
+                    {
+                        set_normal(row_normal[i], border_normal_sum(position, i, j));
+                    }
+                    continue;
+                }
+                set_normal(row_normal[0], border_normal_sum(position, 0, j));
+                set_normal(row_normal[row_length - 1], border_normal_sum(position, row_length - 1, j));
+                // Interior masses have all six triangles around the ring right, right up, up, left,
+                // left down, down; neighbouring pairs of the cross products share a factor
+                const glm::dvec3 *up = row - row_length;
+                const glm::dvec3 *down = row + row_length;
+                for (int i = 1; i < row_length - 1; i++)
+                {
+                    const glm::dvec3 p = row[i];
+                    const glm::dvec3 r = row[i + 1] - p;
+                    const glm::dvec3 ru = up[i + 1] - p;
+                    const glm::dvec3 u = up[i] - p;
+                    const glm::dvec3 l = row[i - 1] - p;
+                    const glm::dvec3 ld = down[i - 1] - p;
+                    const glm::dvec3 d = down[i] - p;
+                    set_normal(row_normal[i], glm::cross(ru, u - r) + glm::cross(l, ld - u) + glm::cross(d, r - ld));
+                }
+            }
+        });
+    }
+
     void add_force(glm::dvec3 f)
     {
         for (int i = 0; i < masses.size(); i++)
         {
-            masses[i]->force += f;
+            masses.force[i] += f;
         }
     }
 
     void reset()
     {
-        // reset masses
+        wake_all();
+        // reset masses, the springs and faces only hold indices so they stay valid
         for (int i = 0; i < mass_per_row; i++)
         {
             for (int j = 0; j < mass_per_col; j++)
             {
-                glm::dvec3 initial_position = glm::dvec3((double)i / mass_density, 0, (double)j / mass_density);
-                Mass *mass = get_mass(i, j);
-                mass->position = initial_position;
-                mass->velocity = glm::dvec3(0.0, 0.0, 0.0);
-                mass->force = glm::dvec3(0.0, 0.0, 0.0);
+                glm::dvec3 initial_position = glm::dvec3((double)i / row_density, 0, (double)j / col_density);
+                int mass = get_mass(i, j);
+                masses.position[mass] = initial_position;
+                masses.last_position[mass] = initial_position;
+                masses.velocity[mass] = glm::dvec3(0.0, 0.0, 0.0);
+                masses.force[mass] = glm::dvec3(0.0, 0.0, 0.0);
             }
         }
 
-        // reconnect spring
-        springs.clear();
-        link_springs();
-        // reset face
-        initialize_face();
-
         // pin mass
-        fixed_mass(get_mass(0, 0), glm::dvec3(0.8, 0.0, 0.0));
-        fixed_mass(get_mass(mass_per_row - 1, 0), glm::dvec3(-0.8, 0.0, 0.0));
+        fixed_mass(get_mass(0, 0), glm::dvec3(pin_offset, 0.0, 0.0));
+        fixed_mass(get_mass(mass_per_row - 1, 0), glm::dvec3(-pin_offset, 0.0, 0.0));
 
         // recompute normal
         compute_normal();
     }
 
-    glm::vec3 getWorldPos(Mass *m)
+    glm::vec3 getWorldPos(int i)
     {
-        return cloth_pos + glm::vec3(m->position);
+        return cloth_pos + glm::vec3(masses.position[i]);
     }
 
-    void setWorldPos(Mass *m, glm::vec3 pos)
+    void setWorldPos(int i, glm::vec3 pos)
     {
-        m->position = pos - cloth_pos;
+        masses.position[i] = pos - cloth_pos;
     }
 
-    void collisionResponse(RigidType type, void *object)
+    // Collide with the scene, if any, then with the cloth itself
+    void collisionResponse(const ColliderScene *scene)
     {
-        switch (type)
+        if (scene != nullptr)
         {
-        case RigidType::Empty:
-            break;
-        case RigidType::Ball:
-            collisionResponse(static_cast<Ball *>(object));
-            break;
-        case RigidType::Cube:
-            collisionResponse(static_cast<Cube *>(object));
-            break;
-        case RigidType::Rectangle:
-            collisionResponse(static_cast<Rectangle *>(object));
+            ProfileScope scope(profiler, ProfilePhase::Collision);
+            rigid_collider.resolve(masses, mass_per_row, mass_per_col, face_tile, glm::dvec3(cloth_pos), *scene, continuous_collision, pool,
+                                   asleep_tiles > 0 ? tile_asleep.data() : nullptr);
         }
-    }
-    void collisionResponse(Ball *ball)
-    {
-        // Iterate through each mass in the cloth
-        for (auto &mass : masses)
+        if (self_collision)
         {
-            glm::vec3 dist_vec = getWorldPos(mass) - ball->center;
-            float dist = glm::length(dist_vec);
-            float penetration = ball->radius - dist;
+            collide_with_self();
+        }
+    }
 
-            if (dist < ball->radius)
-            {
-                glm::vec3 normal = glm::normalize(dist_vec);
-                int r = ball->radius;
-                glm::vec3 contact_point = ball->center + normal * (float)r;
-                // glm::vec3 contact_point = ball->center + normal *(float)1.2*(float)r;
-                // Reposition the mass
-                setWorldPos(mass, contact_point);
+    void collide_with_self()
+    {
+        ProfileScope scope(profiler, ProfilePhase::SelfCollision);
+        // Cells about one rest spacing wide, so a triangle only spans a few of them
+        double cell_size = std::max(std::max(1.0 / row_density, 1.0 / col_density), 2.0 * config.thickness);
+        self_collider.resolve(masses, faces, face_tile_begin, config.thickness, cell_size, self_collision_iterations, pool);
+    }
 
-                // Reflect velocity
-                glm::vec3 incoming_v = mass->velocity;
-                float normal_v = glm::dot(incoming_v, normal) + 0.01f;
+    /**
+     * Sleeping works on the face_tile x face_tile tiles of the collider
+     * broadphase. A tile whose masses stay slower than sleep_speed for
+     * sleep_delay falls asleep: its masses are held like the pinned ones
+     * (is_fixed, zero inverse mass), so every integrator, the constraints and
+     * self-collision leave them where they are, the forces skip them and the
+     * springs between two held masses, and the broadphase skips the tile.
+     * A tile wakes when a force is applied to one of its masses, when a
+     * neighbouring tile moves faster than wake_speed, or when the step gets
+     * another scene or its scene changes (ColliderScene::version). Wakes before
+     * a step, sleeps after it.
+     */
 
-                if (normal_v < 0)
-                {
-                    glm::vec3 reflect_v = incoming_v - 2 * normal_v * normal;
-                    mass->velocity = reflect_v * (float)ball->friction;
-                }
+    // True when the whole cloth sleeps on, the step then has nothing to move
+    bool wake_sleeping(const ColliderScene *scene)
+    {
+        const int scene_version = scene != nullptr ? scene->version() : 0;
+        if (scene != sleep_scene || scene_version != sleep_scene_version)
+        {
+            sleep_scene = scene;
+            sleep_scene_version = scene_version;
+            wake_all();
+            return false;
+        }
+        if (asleep_tiles == 0)
+        {
+            return false;
+        }
+        const int tiles_x = (mass_per_row + face_tile - 1) / face_tile;
+        const glm::dvec3 *force = masses.force.data();
+        bool woken = false;
+        for (int t = 0; t < (int)tile_asleep.size(); t++)
+        {
+            if (!tile_asleep[t])
+            {
+                continue;
+            }
+            bool pushed = false;
+            RigidCollision::for_tile_masses(t, tiles_x, face_tile, mass_per_row, mass_per_col, [&](int i) {
+                pushed = pushed || force[i] != glm::dvec3(0.0);
+            });
+            if (pushed)
+            {
+                set_tile_asleep(t, false);
+                woken = true;
             }
         }
+        if (woken)
+        {
+            find_awake_springs();
+        }
+        if (asleep_tiles < (int)tile_asleep.size())
+        {
+            return false;
+        }
+        // Only the pinned masses can still hold a force, and they do not move either
+        std::fill(masses.force.begin(), masses.force.end(), glm::dvec3(0.0));
+        return true;
     }
-    void collisionResponse(Cube *cube) // AABB
+
+    void update_sleeping(double delta_t)
     {
-        // Iterate through each mass in the cloth
-        for (auto &mass : masses)
+        if (!sleeping)
         {
-            glm::vec3 worldPos = getWorldPos(mass);
-            glm::vec3 dist = worldPos - cube->center;
-
-            // half size of the cube
-            double halfSize = cube->size / 2.0;
-
-            // Check if the mass is inside the cube
-            bool insideX = abs(dist.x) < halfSize;
-            bool insideY = abs(dist.y) < halfSize;
-            bool insideZ = abs(dist.z) < halfSize;
+            wake_all();
+            return;
+        }
+        const int tiles_x = (mass_per_row + face_tile - 1) / face_tile;
+        const int tiles_y = (mass_per_col + face_tile - 1) / face_tile;
+        const int tiles = tiles_x * tiles_y;
+        if ((int)tile_asleep.size() != tiles)
+        {
+            tile_asleep.assign(tiles, 0);
+            tile_still_time.assign(tiles, 0.0);
+            tile_speed.assign(tiles, 0.0);
+        }
 
-            if (insideX && insideY && insideZ)
+        // Rms speed over the step in rest spacings, from how far the masses got
+        const glm::dvec3 *position = masses.position.data();
+        const glm::dvec3 *last_position = masses.last_position.data();
+        const double scale = std::max(row_density, col_density) / delta_t;
+        parallel_for(pool, 0, tiles, 4, [&](int begin, int end) {
+            for (int t = begin; t < end; t++)
             {
-                // calculate penetration
-                double penetrationX = halfSize - abs(dist.x);
-                double penetrationY = halfSize - abs(dist.y);
-                double penetrationZ = halfSize - abs(dist.z);
-
-                // find nearest face
-                if (penetrationX < penetrationY && penetrationX < penetrationZ)
+                if (tile_asleep[t])
                 {
-                    dist.x = (dist.x > 0) ? halfSize : -halfSize;
-                }
-                else if (penetrationY < penetrationX && penetrationY < penetrationZ)
-                {
-                    dist.y = (dist.y > 0) ? halfSize : -halfSize;
-                }
-                else
-                {
-                    dist.z = (dist.z > 0) ? halfSize : -halfSize;
+                    tile_speed[t] = 0.0;
+                    continue;
                 }
-                // re-position the mass
-                glm::vec3 newWorldPos = cube->center + dist;
-                setWorldPos(mass, newWorldPos);
-
-                // reflect the velocity
-                glm::vec3 normal = glm::normalize(newWorldPos - worldPos);
-                glm::vec3 incoming_v = mass->velocity;
-                float normal_v = glm::dot(incoming_v, normal);
+                double sum = 0.0;
+                int count = 0;
+                RigidCollision::for_tile_masses(t, tiles_x, face_tile, mass_per_row, mass_per_col, [&](int i) {
+                    if (!pinned[i])
+                    {
+                        glm::dvec3 d = position[i] - last_position[i];
+                        sum += glm::dot(d, d);
+                        count++;
+                    }
+                });
+                tile_speed[t] = count > 0 ? std::sqrt(sum / count) * scale : 0.0;
+                tile_still_time[t] = tile_speed[t] < sleep_speed ? tile_still_time[t] + delta_t : 0.0;
+            }
+        });
 
-                if (normal_v < 0)
+        // Wake the sleeping neighbours of moving tiles, then let the still tiles without one sleep
+        auto moving_neighbour = [&](int t) {
+            const int x = t % tiles_x;
+            const int y = t / tiles_x;
+            for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, tiles_y - 1); ny++)
+            {
+                for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, tiles_x - 1); nx++)
                 {
-                    glm::vec3 reflect_v = incoming_v - 2 * normal_v * normal;
-                    mass->velocity = reflect_v * cube->friction;
+                    if (tile_speed[ny * tiles_x + nx] > wake_speed)
+                    {
+                        return true;
+                    }
                 }
             }
+            return false;
+        };
+        woken_tiles.clear();
+        for (int t = 0; t < tiles && asleep_tiles > 0; t++)
+        {
+            if (tile_asleep[t] && moving_neighbour(t))
+            {
+                woken_tiles.push_back(t);
+            }
+        }
+        bool changed = !woken_tiles.empty();
+        for (int t : woken_tiles)
+        {
+            set_tile_asleep(t, false);
+        }
+        for (int t = 0; t < tiles; t++)
+        {
+            if (!tile_asleep[t] && tile_still_time[t] >= sleep_delay && !moving_neighbour(t))
+            {
+                set_tile_asleep(t, true);
+                changed = true;
+            }
+        }
+        if (changed)
+        {
+            find_awake_springs();
         }
     }
-    void collisionResponse(Rectangle *rectangle) // AABB
+
+    void wake_all()
     {
-        // Iterate through each mass in the cloth
-        for (auto &mass : masses)
+        if (asleep_tiles == 0)
         {
-            glm::vec3 worldPos = getWorldPos(mass);
-            glm::vec3 dist = worldPos - rectangle->center;
-
-            // Half sizes of the rectangle
-            double halfWidth = rectangle->width / 2.0;
-            double halfHeight = rectangle->height / 2.0;
-            double halfDepth = rectangle->depth / 2.0;
-
-            // Check if the mass is inside the rectangle
-            bool insideX = abs(dist.x) < halfWidth;
-            bool insideY = abs(dist.y) < halfHeight;
-            bool insideZ = abs(dist.z) < halfDepth;
-
-            if (insideX && insideY && insideZ)
+            return;
+        }
+        for (int t = 0; t < (int)tile_asleep.size(); t++)
+        {
+            if (tile_asleep[t])
             {
-                // Calculate penetration
-                double penetrationX = halfWidth - abs(dist.x);
-                double penetrationY = halfHeight - abs(dist.y);
-                double penetrationZ = halfDepth - abs(dist.z);
+                set_tile_asleep(t, false);
+            }
+        }
+        find_awake_springs();
+    }
 
-                // Find nearest face
-                if (penetrationX < penetrationY && penetrationX < penetrationZ)
-                {
-                    dist.x = (dist.x > 0) ? halfWidth : -halfWidth;
-                }
-                else if (penetrationY < penetrationX && penetrationY < penetrationZ)
-                {
-                    dist.y = (dist.y > 0) ? halfHeight : -halfHeight;
-                }
-                else
-                {
-                    dist.z = (dist.z > 0) ? halfDepth : -halfDepth;
-                }
+    void set_tile_asleep(int t, bool asleep)
+    {
+        const int tiles_x = (mass_per_row + face_tile - 1) / face_tile;
+        RigidCollision::for_tile_masses(t, tiles_x, face_tile, mass_per_row, mass_per_col, [&](int i) {
+            if (pinned[i])
+            {
+                return;
+            }
+            if (asleep)
+            {
+                masses.velocity[i] = glm::dvec3(0.0);
+                masses.last_position[i] = masses.position[i];
+            }
+            masses.set_fixed(i, asleep);
+        });
+        tile_asleep[t] = asleep;
+        tile_still_time[t] = 0.0;
+        asleep_tiles += asleep ? 1 : -1;
+    }
 
-                // Re-position the mass
-                glm::vec3 newWorldPos = rectangle->center + dist;
-                setWorldPos(mass, newWorldPos);
+    // Ranges of springs with at least one moving end, with short gaps bridged so the spring kernel keeps its vector width
+    void find_awake_springs()
+    {
+        awake_springs.clear();
+        if (asleep_tiles == 0)
+        {
+            return;
+        }
+        const unsigned char *is_fixed = masses.is_fixed.data();
+        for (int s = 0; s < springs.size(); s++)
+        {
+            if (is_fixed[springs.mass1[s]] && is_fixed[springs.mass2[s]])
+            {
+                continue;
+            }
+            if (!awake_springs.empty() && s - awake_springs.back().y < 32 && s - awake_springs.back().x < 4096)
+            {
+                awake_springs.back().y = s + 1;
+            }
+            else
+            {
+                awake_springs.push_back(glm::ivec2(s, s + 1));
+            }
+        }
+    }
 
-                // Reflect the velocity
-                glm::vec3 normal = glm::normalize(newWorldPos - worldPos);
-                glm::vec3 incoming_v = mass->velocity;
-                float normal_v = glm::dot(incoming_v, normal);
+    // Call fn(range_begin, range_end) for the springs of [begin, end) with at least one moving end
+    template <class Fn>
+    void for_each_awake_spring_range(int begin, int end, Fn fn) const
+    {
+        if (asleep_tiles == 0)
+        {
+            fn(begin, end);
+            return;
+        }
+        for (const glm::ivec2 &range : awake_springs)
+        {
+            int range_begin = std::max(range.x, begin);
+            int range_end = std::min(range.y, end);
+            if (range_begin < range_end)
+            {
+                fn(range_begin, range_end);
+            }
+        }
+    }
 
-                if (normal_v < 0)
-                {
-                    glm::vec3 reflect_v = incoming_v - 2 * normal_v * normal;
-                    mass->velocity = reflect_v * rectangle->friction;
-                }
+    // Call fn(run_begin, run_end) for the runs of masses in [begin, end) that are neither pinned nor asleep
+    template <class Fn>
+    void for_each_moving_range(int begin, int end, Fn fn) const
+    {
+        const unsigned char *is_fixed = masses.is_fixed.data();
+        int i = begin;
+        while (i < end)
+        {
+            while (i < end && is_fixed[i])
+            {
+                i++;
+            }
+            int run_begin = i;
+            while (i < end && !is_fixed[i])
+            {
+                i++;
+            }
+            if (run_begin < i)
+            {
+                fn(run_begin, i);
             }
         }
     }
@@ -0,0 +1,755 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mass.h"
+#include "rigid.h"
+#include "sdf.h"
+#include "thread_pool.h"
+
+enum class ColliderShape
+{
+    Sphere,      // center and radius
+    Box,         // Axis-aligned, center and half_size
+    OrientedBox, // center and half_size along the columns of axes
+    Capsule,     // Segment from center to end, grown by radius
+    Plane,       // Solid below the plane through center with the given normal
+    Sdf          // Signed distance field placed at center, rotated by axes
+};
+
+/**
+ * A static rigid body the cloth collides with. A mass that ends up inside is
+ * moved onto the nearest point of the surface and the part of its velocity
+ * going into the body is reflected and scaled by friction.
+ */
+struct Collider
+{
+    ColliderShape shape = ColliderShape::Sphere;
+    glm::dvec3 center = glm::dvec3(0.0);
+    glm::dvec3 end = glm::dvec3(0.0);
+    glm::dvec3 half_size = glm::dvec3(0.0);
+    glm::dmat3 axes = glm::dmat3(1.0);
+    glm::dvec3 normal = glm::dvec3(0.0, 1.0, 0.0);
+    double radius = 0.0;
+    double friction = 0.8;
+    std::shared_ptr<const SignedDistanceField> sdf; // Shared by every copy of the collider
+
+    static Collider sphere(const glm::dvec3 &center, double radius, double friction = 0.8)
+    {
+        Collider collider;
+        collider.shape = ColliderShape::Sphere;
+        collider.center = center;
+        collider.radius = radius;
+        collider.friction = friction;
+        return collider;
+    }
+
+    static Collider box(const glm::dvec3 &center, const glm::dvec3 &half_size, double friction = 0.8)
+    {
+        Collider collider;
+        collider.shape = ColliderShape::Box;
+        collider.center = center;
+        collider.half_size = half_size;
+        collider.friction = friction;
+        return collider;
+    }
+
+    // axes holds the unit directions of the box edges as columns
+    static Collider oriented_box(const glm::dvec3 &center, const glm::dvec3 &half_size, const glm::dmat3 &axes, double friction = 0.8)
+    {
+        Collider collider = box(center, half_size, friction);
+        collider.shape = ColliderShape::OrientedBox;
+        collider.axes = axes;
+        return collider;
+    }
+
+    static Collider capsule(const glm::dvec3 &a, const glm::dvec3 &b, double radius, double friction = 0.8)
+    {
+        Collider collider = sphere(a, radius, friction);
+        collider.shape = ColliderShape::Capsule;
+        collider.end = b;
+        return collider;
+    }
+
+    static Collider plane(const glm::dvec3 &point, const glm::dvec3 &normal, double friction = 0.8)
+    {
+        Collider collider;
+        collider.shape = ColliderShape::Plane;
+        collider.center = point;
+        collider.normal = glm::normalize(normal);
+        collider.friction = friction;
+        return collider;
+    }
+
+    // The field is in the coordinates of its mesh, the mesh origin goes to center
+    static Collider distance_field(std::shared_ptr<const SignedDistanceField> sdf, const glm::dvec3 &center,
+                                   const glm::dmat3 &axes = glm::dmat3(1.0), double friction = 0.8)
+    {
+        Collider collider;
+        collider.shape = ColliderShape::Sdf;
+        collider.sdf = sdf;
+        collider.center = center;
+        collider.axes = axes;
+        collider.friction = friction;
+        return collider;
+    }
+
+    Collider translated(const glm::dvec3 &offset) const
+    {
+        Collider collider = *this;
+        collider.center += offset;
+        collider.end += offset;
+        return collider;
+    }
+
+    // Axis-aligned bounds, infinite along the directions a plane does not bound
+    void bounds(glm::dvec3 &low, glm::dvec3 &high) const
+    {
+        const double infinity = std::numeric_limits<double>::infinity();
+        switch (shape)
+        {
+        case ColliderShape::Sphere:
+            low = center - radius;
+            high = center + radius;
+            break;
+        case ColliderShape::Box:
+            low = center - half_size;
+            high = center + half_size;
+            break;
+        case ColliderShape::OrientedBox:
+        case ColliderShape::Sdf:
+        {
+            // The box of the field grid, turned and moved like the box of an oriented box
+            glm::dvec3 middle = shape == ColliderShape::Sdf ? (sdf->low() + sdf->high()) * 0.5 : glm::dvec3(0.0);
+            glm::dvec3 half = shape == ColliderShape::Sdf ? (sdf->high() - sdf->low()) * 0.5 : half_size;
+            glm::dvec3 extent(0.0);
+            for (int k = 0; k < 3; k++)
+            {
+                extent += glm::abs(axes[k]) * half[k];
+            }
+            low = center + axes * middle - extent;
+            high = center + axes * middle + extent;
+            break;
+        }
+        case ColliderShape::Capsule:
+            low = glm::min(center, end) - radius;
+            high = glm::max(center, end) + radius;
+            break;
+        case ColliderShape::Plane:
+            low = glm::dvec3(-infinity);
+            high = glm::dvec3(infinity);
+            for (int k = 0; k < 3; k++)
+            {
+                if (std::abs(normal[k]) == 1.0)
+                {
+                    (normal[k] > 0.0 ? high : low)[k] = center[k];
+                }
+            }
+            break;
+        }
+    }
+
+    // Whether any point of the box [low, high] may lie inside, exact for spheres and planes
+    bool overlaps(const glm::dvec3 &low, const glm::dvec3 &high) const
+    {
+        if (shape == ColliderShape::Sphere)
+        {
+            glm::dvec3 closest = glm::clamp(center, low, high);
+            return glm::dot(closest - center, closest - center) < radius * radius;
+        }
+        if (shape == ColliderShape::Plane)
+        {
+            glm::dvec3 middle = (low + high) * 0.5;
+            return glm::dot(middle - center, normal) < glm::dot((high - low) * 0.5, glm::abs(normal));
+        }
+        glm::dvec3 own_low, own_high;
+        bounds(own_low, own_high);
+        return glm::all(glm::lessThan(low, own_high)) && glm::all(glm::lessThan(own_low, high));
+    }
+
+    // Move a point inside onto the surface, false if it is outside
+    bool push_out(glm::dvec3 &position, glm::dvec3 &contact_normal) const
+    {
+        switch (shape)
+        {
+        case ColliderShape::Sphere:
+            return push_out_of_sphere(center, position, contact_normal);
+        case ColliderShape::Box:
+        {
+            glm::dvec3 local = position - center;
+            if (!push_out_of_box(local, contact_normal))
+            {
+                return false;
+            }
+            position = center + local;
+            return true;
+        }
+        case ColliderShape::OrientedBox:
+        {
+            glm::dvec3 local = glm::transpose(axes) * (position - center);
+            glm::dvec3 local_normal;
+            if (!push_out_of_box(local, local_normal))
+            {
+                return false;
+            }
+            position = center + axes * local;
+            contact_normal = axes * local_normal;
+            return true;
+        }
+        case ColliderShape::Capsule:
+        {
+            glm::dvec3 segment = end - center;
+            double length2 = glm::dot(segment, segment);
+            double t = length2 > 0.0 ? glm::clamp(glm::dot(position - center, segment) / length2, 0.0, 1.0) : 0.0;
+            return push_out_of_sphere(center + segment * t, position, contact_normal);
+        }
+        case ColliderShape::Plane:
+        {
+            double distance = glm::dot(position - center, normal);
+            if (distance >= 0.0)
+            {
+                return false;
+            }
+            position -= normal * distance;
+            contact_normal = normal;
+            return true;
+        }
+        case ColliderShape::Sdf:
+        {
+            // One step down the interpolated gradient, as far as the interpolated depth
+            double distance;
+            glm::dvec3 gradient;
+            if (!sdf->sample(glm::transpose(axes) * (position - center), distance, gradient) || distance >= 0.0)
+            {
+                return false;
+            }
+            double length = glm::length(gradient);
+            if (length == 0.0)
+            {
+                return false;
+            }
+            contact_normal = axes * (gradient / length);
+            position -= contact_normal * distance;
+            return true;
+        }
+        }
+        return false;
+    }
+
+    /**
+     * First time t in [0, 1] at which start + t motion enters the collider and
+     * the outward normal there. False when the path misses it or starts
+     * inside, which is left to push_out.
+     */
+    bool time_of_impact(const glm::dvec3 &start, const glm::dvec3 &motion, double &t, glm::dvec3 &contact_normal) const
+    {
+        switch (shape)
+        {
+        case ColliderShape::Sphere:
+            if (!sphere_time_of_impact(center, start, motion, t))
+            {
+                return false;
+            }
+            contact_normal = glm::normalize(start + motion * t - center);
+            return true;
+        case ColliderShape::Box:
+            return box_time_of_impact(start - center, motion, t, contact_normal);
+        case ColliderShape::OrientedBox:
+        {
+            glm::dmat3 to_local = glm::transpose(axes);
+            glm::dvec3 local_normal;
+            if (!box_time_of_impact(to_local * (start - center), to_local * motion, t, local_normal))
+            {
+                return false;
+            }
+            contact_normal = axes * local_normal;
+            return true;
+        }
+        case ColliderShape::Capsule:
+            return capsule_time_of_impact(start, motion, t, contact_normal);
+        case ColliderShape::Plane:
+        {
+            double start_distance = glm::dot(start - center, normal);
+            double end_distance = start_distance + glm::dot(motion, normal);
+            if (start_distance < 0.0 || end_distance >= 0.0)
+            {
+                return false;
+            }
+            t = start_distance / (start_distance - end_distance);
+            contact_normal = normal;
+            return true;
+        }
+        case ColliderShape::Sdf:
+        {
+            glm::dmat3 to_local = glm::transpose(axes);
+            glm::dvec3 local_normal;
+            if (!sdf_time_of_impact(to_local * (start - center), to_local * motion, t, local_normal))
+            {
+                return false;
+            }
+            contact_normal = axes * local_normal;
+            return true;
+        }
+        }
+        return false;
+    }
+
+    /**
+     * Collide a mass that moved from last_position to position. The swept
+     * test stops it where its path first enters and lets the rest of the
+     * motion slide along the surface, so a fast mass cannot pass through a
+     * thin body within one step. A path that starts inside, as a mass resting
+     * on the surface may by a rounding error, starts from the nearest surface
+     * point instead.
+     */
+    bool collide(const glm::dvec3 &last_position, glm::dvec3 &position, glm::dvec3 &contact_normal) const
+    {
+        glm::dvec3 motion = position - last_position;
+        glm::dvec3 contact = last_position;
+        double t = 0.0;
+        if (!push_out(contact, contact_normal))
+        {
+            if (!time_of_impact(last_position, motion, t, contact_normal))
+            {
+                return push_out(position, contact_normal);
+            }
+            contact = last_position + motion * t;
+        }
+        glm::dvec3 rest = motion * (1.0 - t);
+        position = contact + rest - contact_normal * std::min(0.0, glm::dot(rest, contact_normal));
+        // Sliding along a curved or cornered surface can still end up inside
+        glm::dvec3 slide_normal;
+        if (push_out(position, slide_normal))
+        {
+            contact_normal = slide_normal;
+        }
+        return true;
+    }
+
+private:
+    bool sphere_time_of_impact(const glm::dvec3 &sphere_center, const glm::dvec3 &start, const glm::dvec3 &motion, double &t) const
+    {
+        glm::dvec3 offset = start - sphere_center;
+        double a = glm::dot(motion, motion);
+        double b = glm::dot(offset, motion);
+        double c = glm::dot(offset, offset) - radius * radius;
+        double discriminant = b * b - a * c;
+        if (c < 0.0 || b >= 0.0 || discriminant < 0.0)
+        {
+            return false;
+        }
+        t = (-b - std::sqrt(discriminant)) / a;
+        return t <= 1.0;
+    }
+
+    // Slab test against the box around the origin
+    bool box_time_of_impact(const glm::dvec3 &start, const glm::dvec3 &motion, double &t, glm::dvec3 &contact_normal) const
+    {
+        double enter = -std::numeric_limits<double>::infinity();
+        double leave = std::numeric_limits<double>::infinity();
+        int axis = -1;
+        for (int k = 0; k < 3; k++)
+        {
+            if (motion[k] == 0.0)
+            {
+                if (std::abs(start[k]) >= half_size[k])
+                {
+                    return false;
+                }
+                continue;
+            }
+            double near_time = (-std::copysign(half_size[k], motion[k]) - start[k]) / motion[k];
+            double far_time = (std::copysign(half_size[k], motion[k]) - start[k]) / motion[k];
+            if (near_time > enter)
+            {
+                enter = near_time;
+                axis = k;
+            }
+            leave = std::min(leave, far_time);
+        }
+        if (axis < 0 || enter < 0.0 || enter > 1.0 || enter >= leave)
+        {
+            return false;
+        }
+        t = enter;
+        contact_normal = glm::dvec3(0.0);
+        contact_normal[axis] = motion[axis] > 0.0 ? -1.0 : 1.0;
+        return true;
+    }
+
+    // First entry into the side of the capsule or either end sphere, whichever comes first
+    bool capsule_time_of_impact(const glm::dvec3 &start, const glm::dvec3 &motion, double &t, glm::dvec3 &contact_normal) const
+    {
+        const glm::dvec3 axis = end - center;
+        const glm::dvec3 offset = start - center;
+        const double axis2 = glm::dot(axis, axis);
+        const double along = axis2 > 0.0 ? glm::clamp(glm::dot(offset, axis) / axis2, 0.0, 1.0) : 0.0;
+        if (glm::length(offset - axis * along) < radius)
+        {
+            return false;
+        }
+        bool hit = false;
+        t = std::numeric_limits<double>::infinity();
+        // Infinite cylinder around the axis, kept where the entry lies between the ends
+        const double axis_motion = glm::dot(axis, motion);
+        const double axis_offset = glm::dot(axis, offset);
+        const double a = axis2 * glm::dot(motion, motion) - axis_motion * axis_motion;
+        const double b = axis2 * glm::dot(offset, motion) - axis_offset * axis_motion;
+        const double c = axis2 * glm::dot(offset, offset) - axis_offset * axis_offset - radius * radius * axis2;
+        const double discriminant = b * b - a * c;
+        if (a > 0.0 && discriminant >= 0.0)
+        {
+            double side_time = (-b - std::sqrt(discriminant)) / a;
+            double y = axis_offset + side_time * axis_motion;
+            if (side_time >= 0.0 && side_time <= 1.0 && y > 0.0 && y < axis2)
+            {
+                t = side_time;
+                contact_normal = glm::normalize(offset + motion * t - axis * (y / axis2));
+                hit = true;
+            }
+        }
+        const glm::dvec3 ends[2] = {center, end};
+        for (const glm::dvec3 &cap : ends)
+        {
+            double cap_time;
+            if (sphere_time_of_impact(cap, start, motion, cap_time) && cap_time < t)
+            {
+                t = cap_time;
+                contact_normal = glm::normalize(start + motion * t - cap);
+                hit = true;
+            }
+        }
+        return hit;
+    }
+
+    // Sphere tracing through the field, stepping a little short of the sampled distance
+    bool sdf_time_of_impact(const glm::dvec3 &start, const glm::dvec3 &motion, double &t, glm::dvec3 &contact_normal) const
+    {
+        const double length = glm::length(motion);
+        double distance;
+        glm::dvec3 gradient;
+        if (length == 0.0 || (sdf->sample(start, distance, gradient) && distance < 0.0))
+        {
+            return false;
+        }
+        // Enter and leave the grid box
+        double enter = 0.0;
+        double leave = 1.0;
+        const glm::dvec3 low = sdf->low(), high = sdf->high();
+        for (int k = 0; k < 3; k++)
+        {
+            if (motion[k] == 0.0)
+            {
+                if (start[k] < low[k] || start[k] > high[k])
+                {
+                    return false;
+                }
+                continue;
+            }
+            double a = (low[k] - start[k]) / motion[k];
+            double b = (high[k] - start[k]) / motion[k];
+            enter = std::max(enter, std::min(a, b));
+            leave = std::min(leave, std::max(a, b));
+        }
+        const double tolerance = 0.05 * sdf->voxel_size;
+        for (t = enter; t <= leave; t += 0.9 * std::max(distance, tolerance) / length)
+        {
+            if (!sdf->sample(glm::clamp(start + motion * t, low, high), distance, gradient))
+            {
+                return false;
+            }
+            if (distance < tolerance)
+            {
+                double gradient_length = glm::length(gradient);
+                if (gradient_length == 0.0)
+                {
+                    return false;
+                }
+                contact_normal = gradient / gradient_length;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool push_out_of_sphere(const glm::dvec3 &sphere_center, glm::dvec3 &position, glm::dvec3 &contact_normal) const
+    {
+        glm::dvec3 offset = position - sphere_center;
+        double distance2 = glm::dot(offset, offset);
+        if (distance2 >= radius * radius)
+        {
+            return false;
+        }
+        // A mass right at the center leaves upwards
+        contact_normal = distance2 > 0.0 ? offset / std::sqrt(distance2) : glm::dvec3(0.0, 1.0, 0.0);
+        position = sphere_center + contact_normal * radius;
+        return true;
+    }
+
+    // Through the nearest face of the box around the origin
+    bool push_out_of_box(glm::dvec3 &local, glm::dvec3 &contact_normal) const
+    {
+        glm::dvec3 penetration = half_size - glm::abs(local);
+        if (penetration.x <= 0.0 || penetration.y <= 0.0 || penetration.z <= 0.0)
+        {
+            return false;
+        }
+        int axis = 0;
+        if (penetration.y < penetration[axis])
+        {
+            axis = 1;
+        }
+        if (penetration.z < penetration[axis])
+        {
+            axis = 2;
+        }
+        double side = local[axis] > 0.0 ? 1.0 : -1.0;
+        local[axis] = side * half_size[axis];
+        contact_normal = glm::dvec3(0.0);
+        contact_normal[axis] = side;
+        return true;
+    }
+};
+
+// Collider matching each of the rigid bodies the viewer draws
+inline Collider make_collider(const Ball &ball)
+{
+    return Collider::sphere(glm::dvec3(ball.center), ball.radius, ball.friction);
+}
+
+inline Collider make_collider(const Cube &cube)
+{
+    return Collider::box(glm::dvec3(cube.center), glm::dvec3(cube.size / 2.0), cube.friction);
+}
+
+inline Collider make_collider(const Rectangle &rectangle)
+{
+    return Collider::box(glm::dvec3(rectangle.center), glm::dvec3(rectangle.width, rectangle.height, rectangle.depth) / 2.0,
+                         rectangle.friction);
+}
+
+/**
+ * The static colliders around a cloth, in world coordinates. Every change goes
+ * through the members below and bumps version, which is how a sleeping cloth
+ * notices that a collider appeared, moved or went away.
+ */
+class ColliderScene
+{
+public:
+    void add(const Collider &collider)
+    {
+        colliders.push_back(collider);
+        version_count++;
+    }
+
+    // Replace collider i
+    void set(int i, const Collider &collider)
+    {
+        colliders[i] = collider;
+        version_count++;
+    }
+
+    // Move collider i by offset
+    void translate(int i, const glm::dvec3 &offset)
+    {
+        colliders[i].center += offset;
+        colliders[i].end += offset;
+        version_count++;
+    }
+
+    void clear()
+    {
+        colliders.clear();
+        version_count++;
+    }
+
+    const Collider &operator[](int i) const
+    {
+        return colliders[i];
+    }
+
+    std::vector<Collider>::const_iterator begin() const
+    {
+        return colliders.begin();
+    }
+
+    std::vector<Collider>::const_iterator end() const
+    {
+        return colliders.end();
+    }
+
+    int size() const
+    {
+        return (int)colliders.size();
+    }
+
+    bool empty() const
+    {
+        return colliders.empty();
+    }
+
+    // Changes so far
+    int version() const
+    {
+        return version_count;
+    }
+
+private:
+    std::vector<Collider> colliders;
+    int version_count = 0;
+};
+
+/**
+ * Collides the masses of a grid cloth with every collider of a scene.
+ *
+ * The broadphase bounds tiles of tile x tile masses, drops the colliders that
+ * miss the bounds of the whole cloth and then tests the remaining ones against
+ * every tile. Only the masses of a tile a collider overlaps reach its
+ * narrowphase, so masses far from every collider cost one bounds update.
+ * With continuous collision the tile bounds cover the whole path of each
+ * mass through the step. Tiles own disjoint masses and run in parallel; each mass meets the
+ * colliders in scene order, so the result does not depend on the thread count.
+ * Tiles marked asleep are left out altogether.
+ */
+class RigidCollision
+{
+public:
+    int candidate_pairs = 0; // Tile and collider pairs that reached the narrowphase in the last resolve
+
+    // offset is the world position of the cloth origin, the scene is in world coordinates.
+    // Continuous collision sweeps every mass from its last to its current position.
+    // tile_asleep is optional, one flag per tile in row-major order.
+    void resolve(Masses &masses, int mass_per_row, int mass_per_col, int tile, const glm::dvec3 &offset,
+                 const ColliderScene &scene, bool continuous, ThreadPool *pool, const unsigned char *tile_asleep = nullptr)
+    {
+        candidate_pairs = 0;
+        if (scene.empty())
+        {
+            return;
+        }
+        const int tiles_x = (mass_per_row + tile - 1) / tile;
+        const int tiles_y = (mass_per_col + tile - 1) / tile;
+        const int tiles = tiles_x * tiles_y;
+        tile_low.resize(tiles);
+        tile_high.resize(tiles);
+        tile_pairs.resize(tiles);
+
+        const glm::dvec3 *position = masses.position.data();
+        const glm::dvec3 *last_position = masses.last_position.data();
+        parallel_for(pool, 0, tiles, 4, [&](int begin, int end) {
+            for (int t = begin; t < end; t++)
+            {
+                glm::dvec3 low(std::numeric_limits<double>::infinity());
+                glm::dvec3 high(-std::numeric_limits<double>::infinity());
+                if (tile_asleep != nullptr && tile_asleep[t])
+                {
+                    // Empty bounds, no collider overlaps them
+                    tile_low[t] = low;
+                    tile_high[t] = high;
+                    continue;
+                }
+                for_tile_masses(t, tiles_x, tile, mass_per_row, mass_per_col, [&](int i) {
+                    low = glm::min(low, position[i]);
+                    high = glm::max(high, position[i]);
+                    if (continuous)
+                    {
+                        low = glm::min(low, last_position[i]);
+                        high = glm::max(high, last_position[i]);
+                    }
+                });
+                tile_low[t] = low;
+                tile_high[t] = high;
+            }
+        });
+        glm::dvec3 cloth_low = tile_low[0];
+        glm::dvec3 cloth_high = tile_high[0];
+        for (int t = 1; t < tiles; t++)
+        {
+            cloth_low = glm::min(cloth_low, tile_low[t]);
+            cloth_high = glm::max(cloth_high, tile_high[t]);
+        }
+
+        // Colliders in cloth coordinates that reach the cloth at all
+        near.clear();
+        for (const Collider &collider : scene)
+        {
+            Collider local = collider.translated(-offset);
+            if (local.overlaps(cloth_low, cloth_high))
+            {
+                near.push_back(local);
+            }
+        }
+        if (near.empty())
+        {
+            return;
+        }
+
+        glm::dvec3 *velocity = masses.velocity.data();
+        const unsigned char *is_fixed = masses.is_fixed.data();
+        parallel_for(pool, 0, tiles, 1, [&](int begin, int end) {
+            for (int t = begin; t < end; t++)
+            {
+                tile_pairs[t] = 0;
+                for (const Collider &collider : near)
+                {
+                    if (!collider.overlaps(tile_low[t], tile_high[t]))
+                    {
+                        continue;
+                    }
+                    tile_pairs[t]++;
+                    for_tile_masses(t, tiles_x, tile, mass_per_row, mass_per_col, [&](int i) {
+                        glm::dvec3 contact_normal;
+                        if (is_fixed[i])
+                        {
+                            return;
+                        }
+                        bool contact = continuous ? collider.collide(last_position[i], masses.position[i], contact_normal)
+                                                  : collider.push_out(masses.position[i], contact_normal);
+                        if (!contact)
+                        {
+                            return;
+                        }
+                        double normal_velocity = glm::dot(velocity[i], contact_normal);
+                        if (normal_velocity < 0.0)
+                        {
+                            velocity[i] = (velocity[i] - 2.0 * normal_velocity * contact_normal) * collider.friction;
+                        }
+                    });
+                }
+            }
+        });
+        for (int t = 0; t < tiles; t++)
+        {
+            candidate_pairs += tile_pairs[t];
+        }
+    }
+
+    // Call visit(i) for every mass of tile t, row by row
+    template <class Visit>
+    static void for_tile_masses(int t, int tiles_x, int tile, int mass_per_row, int mass_per_col, Visit &&visit)
+    {
+        const int x0 = t % tiles_x * tile;
+        const int y0 = t / tiles_x * tile;
+        const int x1 = std::min(x0 + tile, mass_per_row);
+        const int y1 = std::min(y0 + tile, mass_per_col);
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                visit(y * mass_per_row + x);
+            }
+        }
+    }
+
+private:
+    std::vector<glm::dvec3> tile_low;
+    std::vector<glm::dvec3> tile_high;
+    std::vector<int> tile_pairs;
+    std::vector<Collider> near;
+};
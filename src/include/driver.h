@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "cloth.h"
+#include "collider.h"
+
+// Shared by the command-line drivers and the simulation thread of the viewer.
+
+#define FRAME_TIME 0.25 // Simulated time of one frame of the viewer
+
+// Hash of every position and velocity
+inline uint64_t state_hash(const Masses &masses)
+{
+    uint64_t hash = fnv1a(masses.position.data(), masses.size() * sizeof(glm::dvec3));
+    return fnv1a(masses.velocity.data(), masses.size() * sizeof(glm::dvec3), hash);
+}
+
+inline bool is_step_method(const std::string &method)
+{
+    return method == "Euler" || method == "RK" || method == "RK45" || method == "VERLET" || method == "IMPLICIT" || method == "XPBD";
+}
+
+// "springs" or "fem"
+inline bool parse_membrane(const std::string &name, MembraneModel &model)
+{
+    if (name == "springs")
+    {
+        model = MembraneModel::Springs;
+        return true;
+    }
+    if (name == "fem")
+    {
+        model = MembraneModel::Fem;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Steps per frame of a method: 25 for the explicit methods on the 32x32 grid,
+ * more on finer grids which need a shorter step, 5 for XPBD and one implicit
+ * step. RK45 is handed the whole frame and picks its own steps.
+ */
+inline int substeps_per_frame(const std::string &method, int resolution)
+{
+    if (method == "IMPLICIT" || method == "RK45")
+    {
+        return 1;
+    }
+    if (method == "XPBD")
+    {
+        return 5;
+    }
+    return (25 * resolution + ClothConfig::reference_masses - 1) / ClothConfig::reference_masses;
+}
+
+inline void step_cloth(Cloth &cloth, const std::string &method, bool constraint, const ColliderScene *scene, double delta_t)
+{
+    if (method == "IMPLICIT")
+    {
+        cloth.implicit_step(constraint, scene, delta_t);
+    }
+    else if (method == "XPBD")
+    {
+        cloth.xpbd_step(constraint, scene, delta_t);
+    }
+    else if (method == "RK")
+    {
+        cloth.rk4_step(constraint, scene, delta_t);
+    }
+    else if (method == "RK45")
+    {
+        cloth.rk45_step(constraint, scene, delta_t);
+    }
+    else if (method == "VERLET")
+    {
+        cloth.explicit_verlet(constraint, scene, delta_t);
+    }
+    else
+    {
+        cloth.step(constraint, scene, delta_t);
+    }
+}
+
+inline bool is_collider(const std::string &name)
+{
+    return name == "none" || name == "ball" || name == "ball_sdf" || name == "cube" || name == "rectangle" || name == "props";
+}
+
+#define MESH_BAND 3 // Voxels around a collider mesh with exact distances
+
+// Distance field of the sphere mesh the viewer draws for the ball, built once per process
+inline std::shared_ptr<const SignedDistanceField> ball_sdf(const Ball &ball)
+{
+    static std::shared_ptr<const SignedDistanceField> field =
+        cached_sdf(make_mesh(ball.sphere->vertexes, ball.sphere->faces), 0.05, MESH_BAND * 0.05, "");
+    return field;
+}
+
+/**
+ * Static props to exercise the broadphase: a floor, a 5x5 field of spheres,
+ * boxes, oriented boxes and capsules around and below the hanging cloth,
+ * and a bar across its path.
+ */
+inline void add_props(ColliderScene &scene)
+{
+    scene.add(Collider::plane(glm::dvec3(0.0, 0.0, 0.0), glm::dvec3(0.0, 1.0, 0.0)));
+    for (int i = 0; i < 5; i++)
+    {
+        for (int j = 0; j < 5; j++)
+        {
+            glm::dvec3 center(-12.0 + 6.0 * i, 1.5, -12.0 + 6.0 * j);
+            switch ((i + j) % 4)
+            {
+            case 0:
+                scene.add(Collider::sphere(center, 1.5));
+                break;
+            case 1:
+                scene.add(Collider::box(center, glm::dvec3(1.5, 1.0, 1.0)));
+                break;
+            case 2:
+            {
+                double angle = glm::radians(15.0 * (i + j));
+                glm::dmat3 axes(glm::dvec3(std::cos(angle), 0.0, -std::sin(angle)), glm::dvec3(0.0, 1.0, 0.0),
+                                glm::dvec3(std::sin(angle), 0.0, std::cos(angle)));
+                scene.add(Collider::oriented_box(center, glm::dvec3(1.0, 1.5, 0.5), axes));
+                break;
+            }
+            default:
+                scene.add(Collider::capsule(center - glm::dvec3(1.0, 0.0, 0.0), center + glm::dvec3(1.0, 0.0, 1.0), 0.5));
+                break;
+            }
+        }
+    }
+    scene.add(Collider::capsule(glm::dvec3(-9.0, 8.0, 2.0), glm::dvec3(9.0, 8.0, 2.0), 0.5));
+}
+
+// Collider of a driver option: "none", "ball", "ball_sdf", "cube", "rectangle" or "props", false for anything else
+inline bool pick_collider(const std::string &name, const Ball &ball, const Cube &cube, const Rectangle &rectangle, ColliderScene &scene)
+{
+    if (name == "ball")
+    {
+        scene.add(make_collider(ball));
+    }
+    else if (name == "ball_sdf")
+    {
+        scene.add(Collider::distance_field(ball_sdf(ball), glm::dvec3(ball.center), glm::dmat3(1.0), ball.friction));
+    }
+    else if (name == "cube")
+    {
+        scene.add(make_collider(cube));
+    }
+    else if (name == "rectangle")
+    {
+        scene.add(make_collider(rectangle));
+    }
+    else if (name == "props")
+    {
+        add_props(scene);
+    }
+    else if (name != "none")
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Add the colliders of a scene file, one per line in world coordinates,
+ * each optionally followed by its friction; # starts a comment:
+ *   sphere cx cy cz radius
+ *   box cx cy cz hx hy hz
+ *   obox cx cy cz hx hy hz ax ay az degrees   (rotated about the axis a)
+ *   capsule ax ay az bx by bz radius
+ *   plane px py pz nx ny nz                  (solid below, against n)
+ *   mesh file.obj cx cy cz voxel              (signed distance field of a closed mesh, cached in file.obj.sdf)
+ */
+inline bool load_scene(const std::string &path, ColliderScene &scene)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cout << "ERROR::load_scene : Failed to open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line))
+    {
+        line_number++;
+        std::stringstream fields(line.substr(0, line.find('#')));
+        std::string shape;
+        if (!(fields >> shape))
+        {
+            continue;
+        }
+        // A mesh path is relative to the scene file
+        std::string mesh_path;
+        if (shape == "mesh" && fields >> mesh_path && mesh_path[0] != '/' && path.find('/') != std::string::npos)
+        {
+            mesh_path = path.substr(0, path.rfind('/') + 1) + mesh_path;
+        }
+        int count = shape == "sphere" ? 4 : shape == "box" ? 6 : shape == "obox" ? 10 : shape == "capsule" ? 7 : shape == "plane" ? 6 : shape == "mesh" ? 4 : 0;
+        double v[10] = {0.0};
+        int read = 0;
+        while (read < count && fields >> v[read])
+        {
+            read++;
+        }
+        double friction = 0.8;
+        double value;
+        if (fields >> value)
+        {
+            friction = value;
+        }
+        bool degenerate = (shape == "plane" && glm::length(glm::dvec3(v[3], v[4], v[5])) == 0.0) ||
+                          (shape == "obox" && glm::length(glm::dvec3(v[6], v[7], v[8])) == 0.0) ||
+                          (shape == "mesh" && v[3] <= 0.0);
+        if (count == 0 || read < count || !fields.eof() || degenerate)
+        {
+            std::cout << "ERROR::load_scene : " << path << ":" << line_number << ": bad collider " << shape << std::endl;
+            return false;
+        }
+        glm::dvec3 a(v[0], v[1], v[2]);
+        glm::dvec3 b(v[3], v[4], v[5]);
+        if (shape == "sphere")
+        {
+            scene.add(Collider::sphere(a, v[3], friction));
+        }
+        else if (shape == "box")
+        {
+            scene.add(Collider::box(a, b, friction));
+        }
+        else if (shape == "obox")
+        {
+            glm::dvec3 axis = glm::normalize(glm::dvec3(v[6], v[7], v[8]));
+            // Rodrigues rotation of the unit vectors about the axis
+            double angle = glm::radians(v[9]);
+            glm::dmat3 cross_matrix(glm::dvec3(0.0, axis.z, -axis.y), glm::dvec3(-axis.z, 0.0, axis.x), glm::dvec3(axis.y, -axis.x, 0.0));
+            glm::dmat3 axes = glm::dmat3(1.0) + std::sin(angle) * cross_matrix + (1.0 - std::cos(angle)) * cross_matrix * cross_matrix;
+            scene.add(Collider::oriented_box(a, b, axes, friction));
+        }
+        else if (shape == "capsule")
+        {
+            scene.add(Collider::capsule(a, b, v[6], friction));
+        }
+        else if (shape == "mesh")
+        {
+            TriangleMesh mesh;
+            if (!load_obj(mesh_path, mesh))
+            {
+                return false;
+            }
+            scene.add(Collider::distance_field(cached_sdf(mesh, v[3], MESH_BAND * v[3], mesh_path + ".sdf"), a, glm::dmat3(1.0), friction));
+        }
+        else
+        {
+            scene.add(Collider::plane(a, b, friction));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "spring.h"
+#include "bending.h"
+#include "thread_pool.h"
+
+/**
+ * Symmetric 3x3 block-sparse matrix with the sparsity of the spring graph:
+ * one block per mass on the diagonal and one block per spring off the diagonal.
+ * Block (mass2[s], mass1[s]) is the transpose of block (mass1[s], mass2[s]),
+ * so the rows are just the CSR adjacency of Springs and no extra index arrays
+ * are stored. Spring blocks are symmetric, membrane blocks need not be.
+ * The bending matrix adds its constant isotropic blocks, scaled by
+ * bending_scale, straight from the rows of IsometricBending.
+ */
+class SpringBlockMatrix
+{
+public:
+    std::vector<glm::dmat3> diagonal;         // Block (i, i) of every mass
+    std::vector<glm::dmat3> off_diagonal;     // Block shared by both endpoints of every spring
+    std::vector<glm::dmat3> diagonal_inverse; // Block-Jacobi preconditioner
+    const IsometricBending *bending = nullptr; // Off-diagonal bending entries, their diagonal is part of diagonal
+    double bending_scale = 0.0;
+
+    void resize(int mass_count, int spring_count)
+    {
+        diagonal.resize(mass_count);
+        diagonal_inverse.resize(mass_count);
+        off_diagonal.resize(spring_count);
+    }
+
+    // y = A x
+    void multiply(const Springs &springs, const glm::dvec3 *x, glm::dvec3 *y, ThreadPool *pool) const
+    {
+        const int *mass1 = springs.mass1.data();
+        const int *mass2 = springs.mass2.data();
+        const int *adjacency_begin = springs.adjacency_begin.data();
+        const int *adjacency = springs.adjacency.data();
+        parallel_for(pool, 0, (int)diagonal.size(), 1024, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                glm::dvec3 sum = diagonal[i] * x[i];
+                for (int a = adjacency_begin[i]; a < adjacency_begin[i + 1]; a++)
+                {
+                    int s = adjacency[a];
+                    if (s >= 0)
+                    {
+                        sum += off_diagonal[s] * x[mass2[s]];
+                    }
+                    else
+                    {
+                        sum += x[mass1[~s]] * off_diagonal[~s]; // transpose(block) x
+                    }
+                }
+                if (bending != nullptr)
+                {
+                    for (int a = bending->row_begin[i]; a < bending->row_begin[i + 1]; a++)
+                    {
+                        sum += (bending_scale * bending->weight[a]) * x[bending->column[a]];
+                    }
+                }
+                y[i] = sum;
+            }
+        });
+    }
+};
+
+/**
+ * Preconditioned conjugate gradient on a SpringBlockMatrix.
+ * Masses flagged in filter (the fixed ones) are constrained to a zero solution,
+ * as in the modified PCG of Baraff & Witkin. The work vectors are kept between
+ * solves so a step does not allocate.
+ */
+class ConjugateGradient
+{
+public:
+    std::vector<glm::dvec3> r;
+    std::vector<glm::dvec3> z;
+    std::vector<glm::dvec3> p;
+    std::vector<glm::dvec3> q;
+    std::vector<double> partial; // Per-block sums, added up in a fixed order
+    int iterations = 0;          // Iterations of the last solve
+    double residual = 0.0;       // Relative residual of the last solve
+
+    // Solve A x = b starting from x = 0, stop once |r| <= tolerance * |b|
+    void solve(const SpringBlockMatrix &A, const Springs &springs, const unsigned char *filter,
+               const glm::dvec3 *b, glm::dvec3 *x, double tolerance, int max_iterations, ThreadPool *pool)
+    {
+        const int n = (int)A.diagonal.size();
+        r.resize(n);
+        z.resize(n);
+        p.resize(n);
+        q.resize(n);
+
+        parallel_for(pool, 0, n, 2048, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                x[i] = glm::dvec3(0.0);
+                r[i] = filter[i] ? glm::dvec3(0.0) : b[i];
+                z[i] = A.diagonal_inverse[i] * r[i];
+                p[i] = z[i];
+            }
+        });
+        double b_norm = std::sqrt(dot(r.data(), r.data(), n, pool));
+        double rz = dot(r.data(), z.data(), n, pool);
+        iterations = 0;
+        residual = 0.0;
+        if (b_norm == 0.0)
+        {
+            return;
+        }
+
+        while (iterations < max_iterations)
+        {
+            A.multiply(springs, p.data(), q.data(), pool);
+            parallel_for(pool, 0, n, 2048, [&](int begin, int end) {
+                for (int i = begin; i < end; i++)
+                {
+                    if (filter[i])
+                    {
+                        q[i] = glm::dvec3(0.0);
+                    }
+                }
+            });
+            double alpha = rz / dot(p.data(), q.data(), n, pool);
+            parallel_for(pool, 0, n, 2048, [&](int begin, int end) {
+                for (int i = begin; i < end; i++)
+                {
+                    x[i] += alpha * p[i];
+                    r[i] -= alpha * q[i];
+                    z[i] = A.diagonal_inverse[i] * r[i];
+                }
+            });
+            iterations++;
+
+            residual = std::sqrt(dot(r.data(), r.data(), n, pool)) / b_norm;
+            if (residual <= tolerance)
+            {
+                break;
+            }
+
+            double rz_new = dot(r.data(), z.data(), n, pool);
+            double beta = rz_new / rz;
+            rz = rz_new;
+            parallel_for(pool, 0, n, 2048, [&](int begin, int end) {
+                for (int i = begin; i < end; i++)
+                {
+                    p[i] = z[i] + beta * p[i];
+                }
+            });
+        }
+    }
+
+private:
+    // Deterministic parallel dot product: fixed blocks summed in block order
+    double dot(const glm::dvec3 *a, const glm::dvec3 *b, int n, ThreadPool *pool)
+    {
+        const int block = 4096;
+        const int blocks = (n + block - 1) / block;
+        partial.resize(blocks);
+        parallel_for(pool, 0, blocks, 1, [&](int begin, int end) {
+            for (int k = begin; k < end; k++)
+            {
+                double sum = 0.0;
+                for (int i = k * block; i < std::min(n, (k + 1) * block); i++)
+                {
+                    sum += glm::dot(a[i], b[i]);
+                }
+                partial[k] = sum;
+            }
+        });
+        double sum = 0.0;
+        for (int k = 0; k < blocks; k++)
+        {
+            sum += partial[k];
+        }
+        return sum;
+    }
+};
@@ -1,32 +1,75 @@
-#ifndef MASS_H
-#define MASS_H
-
-#include <glm/glm.hpp>
-#include <map>
-#include <vector>
-
-class Spring;
-
-class Mass {
-public:
-    double          m            = 1.0;
-    bool            is_fixed     = false;
-    glm::dvec2      tex_coord;
-    glm::dvec3      normal;
-    glm::dvec3	    position;
-    glm::dvec3      last_position;
-    glm::dvec3      velocity     = glm::dvec3(0, 0, 0);
-    glm::dvec3	    acceleration = glm::dvec3(0, 0, 0);
-    glm::dvec3      force        = glm::dvec3(0, 0, 0);
-
-
-public:
-    Mass(void) {}
-
-	Mass(glm::dvec3 _pos, glm::dvec2 _tex_coord, bool _is_fixed)
-        : position(_pos), last_position(_pos), tex_coord(_tex_coord), is_fixed(_is_fixed) {}
-
-	~Mass() {}
-};
-
-#endif // MASS_H
\ No newline at end of file
+#ifndef MASS_H
+#define MASS_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+/**
+ * Structure-of-arrays store for every mass of a cloth.
+ * Each field lives in its own contiguous array and a mass is just an index,
+ * so the per-step loops only pull in the fields they actually touch.
+ */
+class Masses {
+public:
+    // Hot: read and written by every integrator
+    std::vector<glm::dvec3>    position;
+    std::vector<glm::dvec3>    velocity;
+    std::vector<glm::dvec3>    force;
+    std::vector<double>        inv_m;          // 0 for fixed masses
+    // Warm: constraints, collisions and shading
+    std::vector<glm::dvec3>    last_position;
+    std::vector<glm::dvec3>    normal;
+    // Cold: set up once
+    std::vector<double>        m;
+    std::vector<unsigned char> is_fixed;
+    std::vector<glm::dvec2>    tex_coord;
+
+
+public:
+    int size() const { return (int)position.size(); }
+
+    void reserve(int n) {
+        position.reserve(n);
+        velocity.reserve(n);
+        force.reserve(n);
+        inv_m.reserve(n);
+        last_position.reserve(n);
+        normal.reserve(n);
+        m.reserve(n);
+        is_fixed.reserve(n);
+        tex_coord.reserve(n);
+    }
+
+    // Append a mass and return its index
+    int add(glm::dvec3 _pos, glm::dvec2 _tex_coord, bool _is_fixed, double _m = 1.0) {
+        position.push_back(_pos);
+        velocity.push_back(glm::dvec3(0, 0, 0));
+        force.push_back(glm::dvec3(0, 0, 0));
+        inv_m.push_back(_is_fixed ? 0.0 : 1.0 / _m);
+        last_position.push_back(_pos);
+        normal.push_back(glm::dvec3(0, 0, 0));
+        m.push_back(_m);
+        is_fixed.push_back(_is_fixed);
+        tex_coord.push_back(_tex_coord);
+        return size() - 1;
+    }
+
+    void set_fixed(int i, bool _is_fixed) {
+        is_fixed[i] = _is_fixed;
+        inv_m[i] = _is_fixed ? 0.0 : 1.0 / m[i];
+    }
+
+    void clear() {
+        position.clear();
+        velocity.clear();
+        force.clear();
+        inv_m.clear();
+        last_position.clear();
+        normal.clear();
+        m.clear();
+        is_fixed.clear();
+        tex_coord.clear();
+    }
+};
+
+#endif // MASS_H
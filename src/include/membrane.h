@@ -0,0 +1,515 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mass.h"
+#include "spring.h"
+#include "spring_kernel.h"
+
+/**
+ * Saint Venant-Kirchhoff membrane of linear triangle elements over the faces
+ * of the cloth. Every triangle keeps its rest area A and the inverse D of its
+ * rest edge matrix, taken in a frame of its own plane; a step then needs per
+ * triangle only
+ *
+ *     F = [x1 - x0, x2 - x0] D                 deformation gradient, 3x2
+ *     E = (F^T F - I) / 2                      Green strain
+ *     S = lambda tr(E) I + 2 mu E              second Piola-Kirchhoff stress
+ *     [f1 f2] = -A F S D^T,  f0 = -f1 - f2     corner forces
+ *
+ * Unlike a spring lattice the material is isotropic and has a Poisson ratio.
+ * The kernels write the forces of corners 1 and 2 of each triangle into its
+ * own slots, every mass then gathers its corners, so no pass has data races.
+ */
+class Membrane
+{
+public:
+    std::vector<int> mass0; // Corners of every triangle
+    std::vector<int> mass1;
+    std::vector<int> mass2;
+    std::vector<double> inverse00; // D of every triangle
+    std::vector<double> inverse01;
+    std::vector<double> inverse10;
+    std::vector<double> inverse11;
+    std::vector<double> area;
+    double mu = 0.0;     // Lame coefficients of the plane stress material
+    double lambda = 0.0;
+    // Force on corners 1 and 2 of every triangle, written by the membrane kernel
+    std::vector<double> f1x, f1y, f1z;
+    std::vector<double> f2x, f2y, f2z;
+    // The corners of mass i are corner[corner_begin[i] .. corner_begin[i + 1]), as 3 t + k for corner k of triangle t
+    std::vector<int> corner_begin;
+    std::vector<int> corner;
+    // Spring along edge k (corner k to corner k + 1) of triangle t at 3 t + k, ~s if corner k is mass2 of spring s, no_spring without one
+    std::vector<int> edge_spring;
+    // The edges along spring s are spring_edge[spring_edge_begin[s] .. spring_edge_begin[s + 1])
+    std::vector<int> spring_edge_begin;
+    std::vector<int> spring_edge;
+    // Stiffness block of every edge for the implicit step, oriented from mass1 to mass2 of its spring
+    std::vector<glm::dmat3> edge_block;
+
+    static constexpr int no_spring = 0x7fffffff;
+
+    int size() const { return (int)mass0.size(); }
+
+    /**
+     * Elements for faces (three mass indices per triangle) with the current
+     * positions as the rest shape, of a material with the given 2D Young's
+     * modulus (force per length) and Poisson ratio.
+     */
+    void build(const Masses &masses, const std::vector<int> &faces, double young_modulus, double poisson_ratio)
+    {
+        clear();
+        mu = young_modulus / (2.0 * (1.0 + poisson_ratio));
+        lambda = young_modulus * poisson_ratio / (1.0 - poisson_ratio * poisson_ratio);
+        const int n = (int)faces.size() / 3;
+        for (int t = 0; t < n; t++)
+        {
+            const glm::dvec3 &x0 = masses.position[faces[3 * t]];
+            glm::dvec3 e1 = masses.position[faces[3 * t + 1]] - x0;
+            glm::dvec3 e2 = masses.position[faces[3 * t + 2]] - x0;
+            // Rest edges in the frame u along e1, v in the plane of the triangle
+            double length = glm::length(e1);
+            glm::dvec3 normal = glm::cross(e1, e2);
+            double twice_area = glm::length(normal);
+            mass0.push_back(faces[3 * t]);
+            mass1.push_back(faces[3 * t + 1]);
+            mass2.push_back(faces[3 * t + 2]);
+            if (!(length > 0.0) || !(twice_area > 0.0))
+            {
+                // Degenerate at rest, the element never exerts a force
+                inverse00.push_back(0.0);
+                inverse01.push_back(0.0);
+                inverse10.push_back(0.0);
+                inverse11.push_back(0.0);
+                area.push_back(0.0);
+                continue;
+            }
+            glm::dvec3 u = e1 / length;
+            glm::dvec3 v = glm::cross(normal / twice_area, u);
+            // Dm = [[length, e2.u], [0, e2.v]], with determinant twice_area
+            double e2u = glm::dot(e2, u);
+            double e2v = glm::dot(e2, v);
+            inverse00.push_back(1.0 / length);
+            inverse01.push_back(-e2u / (length * e2v));
+            inverse10.push_back(0.0);
+            inverse11.push_back(1.0 / e2v);
+            area.push_back(0.5 * twice_area);
+        }
+        f1x.assign(n, 0.0);
+        f1y.assign(n, 0.0);
+        f1z.assign(n, 0.0);
+        f2x.assign(n, 0.0);
+        f2y.assign(n, 0.0);
+        f2z.assign(n, 0.0);
+
+        const int mass_count = masses.size();
+        corner_begin.assign(mass_count + 1, 0);
+        for (int c = 0; c < 3 * n; c++)
+        {
+            corner_begin[faces[c] + 1]++;
+        }
+        for (int i = 0; i < mass_count; i++)
+        {
+            corner_begin[i + 1] += corner_begin[i];
+        }
+        corner.resize(3 * n);
+        std::vector<int> fill(corner_begin.begin(), corner_begin.end() - 1);
+        for (int c = 0; c < 3 * n; c++)
+        {
+            corner[fill[faces[c]]++] = c;
+        }
+    }
+
+    // Find the spring along every edge, for the stiffness blocks of the implicit step
+    void link_springs(const Springs &springs)
+    {
+        const int n = size();
+        edge_spring.assign(3 * n, no_spring);
+        spring_edge_begin.assign(springs.size() + 1, 0);
+        for (int e = 0; e < 3 * n; e++)
+        {
+            int a = corner_mass(e);
+            int b = corner_mass(e / 3 * 3 + (e + 1) % 3);
+            for (int j = springs.adjacency_begin[a]; j < springs.adjacency_begin[a + 1]; j++)
+            {
+                int s = springs.adjacency[j];
+                if (s >= 0 && springs.mass2[s] == b)
+                {
+                    edge_spring[e] = s;
+                }
+                else if (s < 0 && springs.mass1[~s] == b)
+                {
+                    edge_spring[e] = s;
+                }
+            }
+            if (edge_spring[e] != no_spring)
+            {
+                spring_edge_begin[spring_of(e) + 1]++;
+            }
+        }
+        for (int s = 0; s < springs.size(); s++)
+        {
+            spring_edge_begin[s + 1] += spring_edge_begin[s];
+        }
+        spring_edge.resize(spring_edge_begin[springs.size()]);
+        std::vector<int> fill(spring_edge_begin.begin(), spring_edge_begin.end() - 1);
+        for (int e = 0; e < 3 * n; e++)
+        {
+            if (edge_spring[e] != no_spring)
+            {
+                spring_edge[fill[spring_of(e)]++] = e;
+            }
+        }
+        edge_block.resize(3 * n);
+    }
+
+    // Sum of the corner forces of mass i
+    glm::dvec3 gather(int i) const
+    {
+        glm::dvec3 f(0.0);
+        for (int a = corner_begin[i]; a < corner_begin[i + 1]; a++)
+        {
+            int t = corner[a] / 3;
+            switch (corner[a] % 3)
+            {
+            case 0:
+                f -= glm::dvec3(f1x[t] + f2x[t], f1y[t] + f2y[t], f1z[t] + f2z[t]);
+                break;
+            case 1:
+                f += glm::dvec3(f1x[t], f1y[t], f1z[t]);
+                break;
+            default:
+                f += glm::dvec3(f2x[t], f2y[t], f2z[t]);
+                break;
+            }
+        }
+        return f;
+    }
+
+    /**
+     * scale times the stiffness -df/dx between the corners of every edge of
+     * the triangles begin .. end, into edge_block. For corners p and q with
+     * g_p the rows of D (g_0 = -g_1 - g_2) the block is
+     *
+     *     A (lambda F g_p (F g_q)^T + mu F g_q (F g_p)^T + mu (g_p . g_q) F F^T + (g_p^T S g_q) I)
+     *
+     * with the negative part of S dropped, so the system stays positive
+     * definite under compression like the spring Jacobian.
+     */
+    void stiffness_blocks(const glm::dvec3 *position, double scale, int begin, int end)
+    {
+        for (int t = begin; t < end; t++)
+        {
+            glm::dvec3 e1 = position[mass1[t]] - position[mass0[t]];
+            glm::dvec3 e2 = position[mass2[t]] - position[mass0[t]];
+            glm::dvec3 a = e1 * inverse00[t] + e2 * inverse10[t];
+            glm::dvec3 b = e1 * inverse01[t] + e2 * inverse11[t];
+            double strain00 = 0.5 * (glm::dot(a, a) - 1.0);
+            double strain11 = 0.5 * (glm::dot(b, b) - 1.0);
+            double strain01 = 0.5 * glm::dot(a, b);
+            double trace = strain00 + strain11;
+            glm::dmat2 stress = positive_part(lambda * trace + 2.0 * mu * strain00, 2.0 * mu * strain01, lambda * trace + 2.0 * mu * strain11);
+
+            glm::dvec2 g[3];
+            g[1] = glm::dvec2(inverse00[t], inverse01[t]);
+            g[2] = glm::dvec2(inverse10[t], inverse11[t]);
+            g[0] = -g[1] - g[2];
+            glm::dvec3 fg[3];
+            for (int k = 0; k < 3; k++)
+            {
+                fg[k] = a * g[k].x + b * g[k].y;
+            }
+            glm::dmat3 ff = glm::outerProduct(a, a) + glm::outerProduct(b, b);
+            const double weight = scale * area[t];
+            for (int k = 0; k < 3; k++)
+            {
+                int e = 3 * t + k;
+                if (edge_spring[e] == no_spring)
+                {
+                    continue;
+                }
+                int p = k;
+                int q = (k + 1) % 3;
+                glm::dmat3 block = weight * (lambda * glm::outerProduct(fg[p], fg[q]) + mu * glm::outerProduct(fg[q], fg[p]) +
+                                             (mu * glm::dot(g[p], g[q])) * ff + glm::dmat3(glm::dot(g[p], stress * g[q])));
+                edge_block[e] = edge_spring[e] >= 0 ? block : glm::transpose(block);
+            }
+        }
+    }
+
+    // Stiffness block along spring s from the edge blocks, zero for a spring along no triangle edge
+    glm::dmat3 spring_block(int s) const
+    {
+        glm::dmat3 block(0.0);
+        for (int a = spring_edge_begin[s]; a < spring_edge_begin[s + 1]; a++)
+        {
+            block += edge_block[spring_edge[a]];
+        }
+        return block;
+    }
+
+    void clear()
+    {
+        mass0.clear();
+        mass1.clear();
+        mass2.clear();
+        inverse00.clear();
+        inverse01.clear();
+        inverse10.clear();
+        inverse11.clear();
+        area.clear();
+        f1x.clear();
+        f1y.clear();
+        f1z.clear();
+        f2x.clear();
+        f2y.clear();
+        f2z.clear();
+        corner_begin.clear();
+        corner.clear();
+        edge_spring.clear();
+        spring_edge_begin.clear();
+        spring_edge.clear();
+        edge_block.clear();
+    }
+
+private:
+    int corner_mass(int c) const
+    {
+        switch (c % 3)
+        {
+        case 0:
+            return mass0[c / 3];
+        case 1:
+            return mass1[c / 3];
+        default:
+            return mass2[c / 3];
+        }
+    }
+
+    int spring_of(int e) const
+    {
+        return edge_spring[e] >= 0 ? edge_spring[e] : ~edge_spring[e];
+    }
+
+    // Symmetric 2x2 [[s00, s01], [s01, s11]] with its negative eigenvalues set to zero
+    static glm::dmat2 positive_part(double s00, double s01, double s11)
+    {
+        double mean = 0.5 * (s00 + s11);
+        double radius = std::sqrt(0.25 * (s00 - s11) * (s00 - s11) + s01 * s01);
+        double high = mean + radius;
+        double low = mean - radius;
+        if (low >= 0.0)
+        {
+            return glm::dmat2(s00, s01, s01, s11);
+        }
+        if (high <= 0.0)
+        {
+            return glm::dmat2(0.0);
+        }
+        // Only the eigenvector of high remains
+        glm::dvec2 v = std::abs(s00 - low) >= std::abs(s11 - low) ? glm::dvec2(s00 - low, s01) : glm::dvec2(s01, s11 - low);
+        v /= glm::length(v);
+        return high * glm::outerProduct(v, v);
+    }
+};
+
+/**
+ * Corner forces of the triangles begin .. end into the f1 and f2 arrays of the
+ * membrane. Picked at runtime like the spring kernels and under the same
+ * names; vector results match the scalar kernel to rounding.
+ */
+typedef void (*MembraneKernel)(const glm::dvec3 *position, Membrane &membrane, int begin, int end);
+
+inline void membrane_forces_scalar(const glm::dvec3 *position, Membrane &membrane, int begin, int end)
+{
+    const double mu = membrane.mu;
+    const double lambda = membrane.lambda;
+    for (int t = begin; t < end; t++)
+    {
+        const glm::dvec3 x0 = position[membrane.mass0[t]];
+        const glm::dvec3 e1 = position[membrane.mass1[t]] - x0;
+        const glm::dvec3 e2 = position[membrane.mass2[t]] - x0;
+        const double d00 = membrane.inverse00[t];
+        const double d01 = membrane.inverse01[t];
+        const double d10 = membrane.inverse10[t];
+        const double d11 = membrane.inverse11[t];
+        // Columns of F
+        const glm::dvec3 a = e1 * d00 + e2 * d10;
+        const glm::dvec3 b = e1 * d01 + e2 * d11;
+        const double strain00 = (glm::dot(a, a) - 1.0) * 0.5;
+        const double strain11 = (glm::dot(b, b) - 1.0) * 0.5;
+        const double strain01 = glm::dot(a, b) * 0.5;
+        const double trace = strain00 + strain11;
+        const double stress00 = lambda * trace + 2.0 * mu * strain00;
+        const double stress11 = lambda * trace + 2.0 * mu * strain11;
+        const double stress01 = 2.0 * mu * strain01;
+        // Columns of F S, then -A F S D^T
+        const glm::dvec3 p0 = a * stress00 + b * stress01;
+        const glm::dvec3 p1 = a * stress01 + b * stress11;
+        const double minus_area = -membrane.area[t];
+        const glm::dvec3 f1 = (p0 * d00 + p1 * d01) * minus_area;
+        const glm::dvec3 f2 = (p0 * d10 + p1 * d11) * minus_area;
+        membrane.f1x[t] = f1.x;
+        membrane.f1y[t] = f1.y;
+        membrane.f1z[t] = f1.z;
+        membrane.f2x[t] = f2.x;
+        membrane.f2y[t] = f2.y;
+        membrane.f2z[t] = f2.z;
+    }
+}
+
+#ifdef CLOTH_SIMD_X86
+__attribute__((target("avx2"))) inline void membrane_forces_avx2(const glm::dvec3 *position, Membrane &membrane, int begin, int end)
+{
+    const double *base = &position[0].x;
+    const __m128i three = _mm_set1_epi32(3);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d lambda = _mm256_set1_pd(membrane.lambda);
+    const __m256d two_mu = _mm256_set1_pd(2.0 * membrane.mu);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    int t = begin;
+    for (; t + 4 <= end; t += 4)
+    {
+        __m128i o0 = _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(membrane.mass0.data() + t)), three);
+        __m128i o1 = _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(membrane.mass1.data() + t)), three);
+        __m128i o2 = _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(membrane.mass2.data() + t)), three);
+        __m256d x0 = _mm256_mask_i32gather_pd(zero, base, o0, all, 8);
+        __m256d y0 = _mm256_mask_i32gather_pd(zero, base + 1, o0, all, 8);
+        __m256d z0 = _mm256_mask_i32gather_pd(zero, base + 2, o0, all, 8);
+        __m256d e1x = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base, o1, all, 8), x0);
+        __m256d e1y = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base + 1, o1, all, 8), y0);
+        __m256d e1z = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base + 2, o1, all, 8), z0);
+        __m256d e2x = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base, o2, all, 8), x0);
+        __m256d e2y = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base + 1, o2, all, 8), y0);
+        __m256d e2z = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base + 2, o2, all, 8), z0);
+        __m256d d00 = _mm256_loadu_pd(membrane.inverse00.data() + t);
+        __m256d d01 = _mm256_loadu_pd(membrane.inverse01.data() + t);
+        __m256d d10 = _mm256_loadu_pd(membrane.inverse10.data() + t);
+        __m256d d11 = _mm256_loadu_pd(membrane.inverse11.data() + t);
+
+        __m256d ax = _mm256_add_pd(_mm256_mul_pd(e1x, d00), _mm256_mul_pd(e2x, d10));
+        __m256d ay = _mm256_add_pd(_mm256_mul_pd(e1y, d00), _mm256_mul_pd(e2y, d10));
+        __m256d az = _mm256_add_pd(_mm256_mul_pd(e1z, d00), _mm256_mul_pd(e2z, d10));
+        __m256d bx = _mm256_add_pd(_mm256_mul_pd(e1x, d01), _mm256_mul_pd(e2x, d11));
+        __m256d by = _mm256_add_pd(_mm256_mul_pd(e1y, d01), _mm256_mul_pd(e2y, d11));
+        __m256d bz = _mm256_add_pd(_mm256_mul_pd(e1z, d01), _mm256_mul_pd(e2z, d11));
+        __m256d aa = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, ax), _mm256_mul_pd(ay, ay)), _mm256_mul_pd(az, az));
+        __m256d bb = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(bx, bx), _mm256_mul_pd(by, by)), _mm256_mul_pd(bz, bz));
+        __m256d ab = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, bx), _mm256_mul_pd(ay, by)), _mm256_mul_pd(az, bz));
+        __m256d strain00 = _mm256_mul_pd(_mm256_sub_pd(aa, one), half);
+        __m256d strain11 = _mm256_mul_pd(_mm256_sub_pd(bb, one), half);
+        __m256d strain01 = _mm256_mul_pd(ab, half);
+        __m256d volume = _mm256_mul_pd(lambda, _mm256_add_pd(strain00, strain11));
+        __m256d stress00 = _mm256_add_pd(volume, _mm256_mul_pd(two_mu, strain00));
+        __m256d stress11 = _mm256_add_pd(volume, _mm256_mul_pd(two_mu, strain11));
+        __m256d stress01 = _mm256_mul_pd(two_mu, strain01);
+
+        __m256d p0x = _mm256_add_pd(_mm256_mul_pd(ax, stress00), _mm256_mul_pd(bx, stress01));
+        __m256d p0y = _mm256_add_pd(_mm256_mul_pd(ay, stress00), _mm256_mul_pd(by, stress01));
+        __m256d p0z = _mm256_add_pd(_mm256_mul_pd(az, stress00), _mm256_mul_pd(bz, stress01));
+        __m256d p1x = _mm256_add_pd(_mm256_mul_pd(ax, stress01), _mm256_mul_pd(bx, stress11));
+        __m256d p1y = _mm256_add_pd(_mm256_mul_pd(ay, stress01), _mm256_mul_pd(by, stress11));
+        __m256d p1z = _mm256_add_pd(_mm256_mul_pd(az, stress01), _mm256_mul_pd(bz, stress11));
+        __m256d minus_area = _mm256_xor_pd(_mm256_loadu_pd(membrane.area.data() + t), sign);
+        _mm256_storeu_pd(membrane.f1x.data() + t, _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(p0x, d00), _mm256_mul_pd(p1x, d01)), minus_area));
+        _mm256_storeu_pd(membrane.f1y.data() + t, _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(p0y, d00), _mm256_mul_pd(p1y, d01)), minus_area));
+        _mm256_storeu_pd(membrane.f1z.data() + t, _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(p0z, d00), _mm256_mul_pd(p1z, d01)), minus_area));
+        _mm256_storeu_pd(membrane.f2x.data() + t, _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(p0x, d10), _mm256_mul_pd(p1x, d11)), minus_area));
+        _mm256_storeu_pd(membrane.f2y.data() + t, _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(p0y, d10), _mm256_mul_pd(p1y, d11)), minus_area));
+        _mm256_storeu_pd(membrane.f2z.data() + t, _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(p0z, d10), _mm256_mul_pd(p1z, d11)), minus_area));
+    }
+    membrane_forces_scalar(position, membrane, t, end);
+}
+
+__attribute__((target("avx512f"))) inline void membrane_forces_avx512(const glm::dvec3 *position, Membrane &membrane, int begin, int end)
+{
+    const double *base = &position[0].x;
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d lambda = _mm512_set1_pd(membrane.lambda);
+    const __m512d two_mu = _mm512_set1_pd(2.0 * membrane.mu);
+    int t = begin;
+    for (; t + 8 <= end; t += 8)
+    {
+        __m256i o0 = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(membrane.mass0.data() + t)), three);
+        __m256i o1 = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(membrane.mass1.data() + t)), three);
+        __m256i o2 = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(membrane.mass2.data() + t)), three);
+        __m512d x0 = _mm512_mask_i32gather_pd(zero, 0xFF, o0, base, 8);
+        __m512d y0 = _mm512_mask_i32gather_pd(zero, 0xFF, o0, base + 1, 8);
+        __m512d z0 = _mm512_mask_i32gather_pd(zero, 0xFF, o0, base + 2, 8);
+        __m512d e1x = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o1, base, 8), x0);
+        __m512d e1y = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o1, base + 1, 8), y0);
+        __m512d e1z = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o1, base + 2, 8), z0);
+        __m512d e2x = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o2, base, 8), x0);
+        __m512d e2y = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o2, base + 1, 8), y0);
+        __m512d e2z = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o2, base + 2, 8), z0);
+        __m512d d00 = _mm512_loadu_pd(membrane.inverse00.data() + t);
+        __m512d d01 = _mm512_loadu_pd(membrane.inverse01.data() + t);
+        __m512d d10 = _mm512_loadu_pd(membrane.inverse10.data() + t);
+        __m512d d11 = _mm512_loadu_pd(membrane.inverse11.data() + t);
+
+        __m512d ax = _mm512_add_pd(_mm512_mul_pd(e1x, d00), _mm512_mul_pd(e2x, d10));
+        __m512d ay = _mm512_add_pd(_mm512_mul_pd(e1y, d00), _mm512_mul_pd(e2y, d10));
+        __m512d az = _mm512_add_pd(_mm512_mul_pd(e1z, d00), _mm512_mul_pd(e2z, d10));
+        __m512d bx = _mm512_add_pd(_mm512_mul_pd(e1x, d01), _mm512_mul_pd(e2x, d11));
+        __m512d by = _mm512_add_pd(_mm512_mul_pd(e1y, d01), _mm512_mul_pd(e2y, d11));
+        __m512d bz = _mm512_add_pd(_mm512_mul_pd(e1z, d01), _mm512_mul_pd(e2z, d11));
+        __m512d aa = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ax, ax), _mm512_mul_pd(ay, ay)), _mm512_mul_pd(az, az));
+        __m512d bb = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(bx, bx), _mm512_mul_pd(by, by)), _mm512_mul_pd(bz, bz));
+        __m512d ab = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ax, bx), _mm512_mul_pd(ay, by)), _mm512_mul_pd(az, bz));
+        __m512d strain00 = _mm512_mul_pd(_mm512_sub_pd(aa, one), half);
+        __m512d strain11 = _mm512_mul_pd(_mm512_sub_pd(bb, one), half);
+        __m512d strain01 = _mm512_mul_pd(ab, half);
+        __m512d volume = _mm512_mul_pd(lambda, _mm512_add_pd(strain00, strain11));
+        __m512d stress00 = _mm512_add_pd(volume, _mm512_mul_pd(two_mu, strain00));
+        __m512d stress11 = _mm512_add_pd(volume, _mm512_mul_pd(two_mu, strain11));
+        __m512d stress01 = _mm512_mul_pd(two_mu, strain01);
+
+        __m512d p0x = _mm512_add_pd(_mm512_mul_pd(ax, stress00), _mm512_mul_pd(bx, stress01));
+        __m512d p0y = _mm512_add_pd(_mm512_mul_pd(ay, stress00), _mm512_mul_pd(by, stress01));
+        __m512d p0z = _mm512_add_pd(_mm512_mul_pd(az, stress00), _mm512_mul_pd(bz, stress01));
+        __m512d p1x = _mm512_add_pd(_mm512_mul_pd(ax, stress01), _mm512_mul_pd(bx, stress11));
+        __m512d p1y = _mm512_add_pd(_mm512_mul_pd(ay, stress01), _mm512_mul_pd(by, stress11));
+        __m512d p1z = _mm512_add_pd(_mm512_mul_pd(az, stress01), _mm512_mul_pd(bz, stress11));
+        __m512d minus_area = _mm512_sub_pd(zero, _mm512_loadu_pd(membrane.area.data() + t));
+        _mm512_storeu_pd(membrane.f1x.data() + t, _mm512_mul_pd(_mm512_add_pd(_mm512_mul_pd(p0x, d00), _mm512_mul_pd(p1x, d01)), minus_area));
+        _mm512_storeu_pd(membrane.f1y.data() + t, _mm512_mul_pd(_mm512_add_pd(_mm512_mul_pd(p0y, d00), _mm512_mul_pd(p1y, d01)), minus_area));
+        _mm512_storeu_pd(membrane.f1z.data() + t, _mm512_mul_pd(_mm512_add_pd(_mm512_mul_pd(p0z, d00), _mm512_mul_pd(p1z, d01)), minus_area));
+        _mm512_storeu_pd(membrane.f2x.data() + t, _mm512_mul_pd(_mm512_add_pd(_mm512_mul_pd(p0x, d10), _mm512_mul_pd(p1x, d11)), minus_area));
+        _mm512_storeu_pd(membrane.f2y.data() + t, _mm512_mul_pd(_mm512_add_pd(_mm512_mul_pd(p0y, d10), _mm512_mul_pd(p1y, d11)), minus_area));
+        _mm512_storeu_pd(membrane.f2z.data() + t, _mm512_mul_pd(_mm512_add_pd(_mm512_mul_pd(p0z, d10), _mm512_mul_pd(p1z, d11)), minus_area));
+    }
+    membrane_forces_scalar(position, membrane, t, end);
+}
+#endif
+
+// Membrane kernel of the same name as a spring kernel, nullptr if this CPU lacks it
+inline MembraneKernel membrane_kernel_by_name(const char *name)
+{
+    if (!spring_kernel_supported(name))
+    {
+        return nullptr;
+    }
+#ifdef CLOTH_SIMD_X86
+    if (!strcmp(name, "avx2"))
+    {
+        return membrane_forces_avx2;
+    }
+    if (!strcmp(name, "avx512"))
+    {
+        return membrane_forces_avx512;
+    }
+#endif
+    return membrane_forces_scalar;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+#include "trace.h"
+
+// Phases of a simulation step, in report order
+enum class ProfilePhase
+{
+    Forces,
+    Integration,
+    Constraints,
+    VelocityUpdate,
+    Collision,
+    SelfCollision,
+    Normals,
+    COUNT
+};
+
+inline const char *profile_phase_name(ProfilePhase phase)
+{
+    static const char *names[] = {"forces", "integration", "constraints", "velocity update", "collision", "self collision", "normals"};
+    return names[(int)phase];
+}
+
+/**
+ * Log-linear histogram of durations in nanoseconds.
+ * Each power of two is split into 8 buckets, so quantiles are within 1/16 of
+ * the true value while recording stays a handful of integer operations.
+ */
+class DurationHistogram
+{
+public:
+    static constexpr int sub_buckets = 8;
+    static constexpr int bucket_count = sub_buckets + (64 - 3) * sub_buckets;
+
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    uint64_t buckets[bucket_count] = {0};
+
+    void record(uint64_t ns)
+    {
+        count++;
+        total += ns;
+        min = std::min(min, ns);
+        max = std::max(max, ns);
+        buckets[bucket_of(ns)]++;
+    }
+
+    // Duration below which a fraction q of the recorded durations fall
+    uint64_t quantile(double q) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)(q * count + 0.5));
+        uint64_t seen = 0;
+        for (int b = 0; b < bucket_count; b++)
+        {
+            seen += buckets[b];
+            if (seen >= rank)
+            {
+                uint64_t middle = bucket_low(b) + (bucket_low(b + 1) - bucket_low(b)) / 2;
+                return std::min(max, std::max(min, middle));
+            }
+        }
+        return max;
+    }
+
+    void clear()
+    {
+        *this = DurationHistogram();
+    }
+
+private:
+    static int bucket_of(uint64_t ns)
+    {
+        if (ns < sub_buckets)
+        {
+            return (int)ns;
+        }
+        int exponent = 63 - __builtin_clzll(ns);
+        return sub_buckets + (exponent - 3) * sub_buckets + (int)((ns >> (exponent - 3)) & (sub_buckets - 1));
+    }
+
+    static uint64_t bucket_low(int b)
+    {
+        if (b < sub_buckets)
+        {
+            return (uint64_t)b;
+        }
+        if (b >= bucket_count)
+        {
+            return UINT64_MAX;
+        }
+        int exponent = (b - sub_buckets) / sub_buckets + 3;
+        return (uint64_t)(sub_buckets + (b - sub_buckets) % sub_buckets) << (exponent - 3);
+    }
+};
+
+/**
+ * Per-phase timings of the simulation step. A Cloth with a profiler set
+ * records every phase through ProfileScope; phases are recorded on the thread
+ * that steps the cloth, so one profiler must not be shared between threads.
+ */
+class Profiler
+{
+public:
+    bool enabled = true;
+    DurationHistogram phases[(int)ProfilePhase::COUNT];
+
+    void record(ProfilePhase phase, uint64_t ns)
+    {
+        phases[(int)phase].record(ns);
+    }
+
+    void clear()
+    {
+        for (auto &histogram : phases)
+        {
+            histogram.clear();
+        }
+    }
+
+    void report(std::ostream &out) const
+    {
+        std::ios::fmtflags flags = out.flags();
+        out << std::left << std::setw(16) << "phase" << std::right << std::setw(10) << "calls" << std::setw(12) << "total ms"
+            << std::setw(10) << "min us" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "max us" << std::endl;
+        out << std::fixed;
+        for (int p = 0; p < (int)ProfilePhase::COUNT; p++)
+        {
+            const DurationHistogram &histogram = phases[p];
+            if (histogram.count == 0)
+            {
+                continue;
+            }
+            out << std::left << std::setw(16) << profile_phase_name((ProfilePhase)p) << std::right
+                << std::setw(10) << histogram.count
+                << std::setw(12) << std::setprecision(2) << histogram.total * 1e-6
+                << std::setprecision(1)
+                << std::setw(10) << histogram.min * 1e-3
+                << std::setw(10) << histogram.quantile(0.5) * 1e-3
+                << std::setw(10) << histogram.quantile(0.99) * 1e-3
+                << std::setw(10) << histogram.max * 1e-3 << std::endl;
+        }
+        out.flags(flags);
+    }
+};
+
+// Records the lifetime of the scope as one call of a phase and, while tracing
+// is on, as a trace event. Free without a profiler and with tracing off.
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler *_profiler, ProfilePhase _phase)
+        : profiler(_profiler != nullptr && _profiler->enabled ? _profiler : nullptr), phase(_phase), tracing(trace_enabled())
+    {
+        if (profiler != nullptr || tracing)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ProfileScope()
+    {
+        if (profiler == nullptr && !tracing)
+        {
+            return;
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        if (profiler != nullptr)
+        {
+            profiler->record(phase, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+        if (tracing)
+        {
+            Tracer::instance().record(profile_phase_name(phase), "phase", start, end);
+        }
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    Profiler *profiler;
+    ProfilePhase phase;
+    bool tracing;
+    std::chrono::steady_clock::time_point start;
+};
@@ -36,7 +36,8 @@ Light sun;
 
 struct ClothRender {
     const Cloth* cloth;
-    int massCount; // Number of all masses in faces
+    int massCount; // Number of masses, one vertex each
+    int indexCount; // Number of mass indices in faces
     
     glm::vec3 *vboPos; // Position
     glm::vec2 *vboTex; // Texture
@@ -45,6 +46,7 @@ struct ClothRender {
     GLuint programID;
     GLuint vaoID;
     GLuint vboIDs[3];
+    GLuint eboID; // Static index buffer of the faces
     GLuint texID;
     
     GLint aPtrPos;
@@ -52,8 +54,9 @@ struct ClothRender {
     GLint aPtrNor;
     
     ClothRender(Cloth* cloth) {
-        massCount = (int)(cloth->faces.size());
-        if (massCount <= 0) {
+        massCount = cloth->masses.size();
+        indexCount = (int)(cloth->faces.size());
+        if (massCount <= 0 || indexCount <= 0) {
             std::cout << "ERROR::ClothRender : No mass exists." << std::endl;
             exit(-1);
         }
@@ -63,11 +66,11 @@ struct ClothRender {
         vboPos = new glm::vec3[massCount];
         vboTex = new glm::vec2[massCount];
         vboNor = new glm::vec3[massCount];
+        const Masses& masses = cloth->masses;
         for (int i = 0; i < massCount; i ++) {
-            Mass* m = cloth->faces[i];
-            vboPos[i] = glm::vec3(m->position);
-            vboTex[i] = glm::vec2(m->tex_coord); // Texture coord will only be set here
-            vboNor[i] = glm::vec3(m->normal);
+            vboPos[i] = glm::vec3(masses.position[i]);
+            vboTex[i] = glm::vec2(masses.tex_coord[i]); // Texture coord will only be set here
+            vboNor[i] = glm::vec3(masses.normal[i]);
         }
         
         /** Build render program **/
@@ -78,6 +81,7 @@ struct ClothRender {
         // Generate ID of VAO and VBOs
         glGenVertexArrays(1, &vaoID);
         glGenBuffers(3, vboIDs);
+        glGenBuffers(1, &eboID);
         
         // Attribute pointers of VAO
         aPtrPos = 0;
@@ -93,11 +97,14 @@ struct ClothRender {
         // Texture buffer
         glBindBuffer(GL_ARRAY_BUFFER, vboIDs[1]);
         glVertexAttribPointer(aPtrTex, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glBufferData(GL_ARRAY_BUFFER, massCount*sizeof(glm::vec2), vboTex, GL_DYNAMIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, massCount*sizeof(glm::vec2), vboTex, GL_STATIC_DRAW);
         // Normal buffer
         glBindBuffer(GL_ARRAY_BUFFER, vboIDs[2]);
         glVertexAttribPointer(aPtrNor, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
         glBufferData(GL_ARRAY_BUFFER, massCount*sizeof(glm::vec3), vboNor, GL_DYNAMIC_DRAW);
+        // Index buffer, the faces never change so it is uploaded once and stays bound to the VAO
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eboID);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount*sizeof(GLuint), cloth->faces.data(), GL_STATIC_DRAW);
         
         // Enable it's attribute pointers since they were set well
         glEnableVertexAttribArray(aPtrPos);
@@ -159,6 +166,7 @@ struct ClothRender {
         if (vaoID) {
             glDeleteVertexArrays(1, &vaoID);
             glDeleteBuffers(3, vboIDs);
+            glDeleteBuffers(1, &eboID);
             vaoID = 0;
         }
         
@@ -168,12 +176,13 @@ struct ClothRender {
         }
     }
     
-    void flush() {
-        // Update all the positions of masses
-        for (int i = 0; i < massCount; i ++) { // Tex coordinate dose not change
-            Mass* m = cloth->faces[i];
-            vboPos[i] = glm::vec3(m->position);
-            vboNor[i] = glm::vec3(m->normal);
+    // Draw the cloth with positions and normals of a published frame, indexed like the masses
+    void flush(const glm::dvec3* position, const glm::dvec3* normal) {
+        TraceScope trace("ClothRender::flush", "render");
+        // Update the positions and normals of masses, tex coordinates and indices do not change
+        for (int i = 0; i < massCount; i ++) {
+            vboPos[i] = glm::vec3(position[i]);
+            vboNor[i] = glm::vec3(normal[i]);
         }
         
         glUseProgram(programID);
@@ -182,8 +191,6 @@ struct ClothRender {
         
         glBindBuffer(GL_ARRAY_BUFFER, vboIDs[0]);
         glBufferSubData(GL_ARRAY_BUFFER, 0, massCount*sizeof(glm::vec3), vboPos);
-        glBindBuffer(GL_ARRAY_BUFFER, vboIDs[1]);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, massCount* sizeof(glm::vec2), vboTex);
         glBindBuffer(GL_ARRAY_BUFFER, vboIDs[2]);
         glBufferSubData(GL_ARRAY_BUFFER, 0, massCount* sizeof(glm::vec3), vboNor);
         
@@ -200,9 +207,9 @@ struct ClothRender {
         
         /** Draw **/
         if (cloth->draw_texture) {
-            glDrawArrays(GL_TRIANGLES, 0, massCount);
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, (void*)0);
         } else {
-            glDrawArrays(GL_LINES, 0, massCount);
+            glDrawElements(GL_LINES, indexCount, GL_UNSIGNED_INT, (void*)0);
         }
         
         // End flushing
@@ -214,7 +221,8 @@ struct ClothRender {
 };
 
 struct SpringRender {
-    std::vector<Spring*> springs;
+    const Masses* masses;
+    const Springs* springs;
     int springCount; // Number of masses in springs
     
     glm::vec4 uniSpringColor;
@@ -230,9 +238,10 @@ struct SpringRender {
     GLint aPtrNor;
     
     // Render any spring set, color and modelVector
-    void init(std::vector<Spring*> s, glm::vec4 c, glm::vec3 modelVec) {
+    void init(const Masses* m, const Springs* s, glm::vec4 c, glm::vec3 modelVec) {
+        masses = m;
         springs = s;
-        springCount = (int)(springs.size());
+        springCount = springs->size();
         if (springCount <= 0) {
             std::cout << "ERROR::SpringRender : No mass exists." << std::endl;
             exit(-1);
@@ -243,12 +252,12 @@ struct SpringRender {
         vboPos = new glm::vec3[springCount*2];
         vboNor = new glm::vec3[springCount*2];
         for (int i = 0; i < springCount; i ++) {
-            Mass* mass1 = springs[i]->mass1;
-            Mass* mass2 = springs[i]->mass2;
-            vboPos[i*2] = glm::vec3(mass1->position);
-            vboPos[i*2+1] = glm::vec3(mass2->position);
-            vboNor[i*2] = glm::vec3(mass1->normal);
-            vboNor[i*2+1] = glm::vec3(mass2->normal);
+            int mass1 = springs->mass1[i];
+            int mass2 = springs->mass2[i];
+            vboPos[i*2] = glm::vec3(masses->position[mass1]);
+            vboPos[i*2+1] = glm::vec3(masses->position[mass2]);
+            vboNor[i*2] = glm::vec3(masses->normal[mass1]);
+            vboNor[i*2+1] = glm::vec3(masses->normal[mass2]);
         }
         
         /** Build render program **/
@@ -317,15 +326,16 @@ struct SpringRender {
         }
     }
     
-    void flush() {
+    void flush(const glm::dvec3* position, const glm::dvec3* normal) {
+        TraceScope trace("SpringRender::flush", "render");
         // Update all the positions of masses
         for (int i = 0; i < springCount; i ++) {
-            Mass* mass1 = springs[i]->mass1;
-            Mass* mass2 = springs[i]->mass2;
-            vboPos[i*2] = glm::vec3(mass1->position);
-            vboPos[i*2+1] = glm::vec3(mass2->position);
-            vboNor[i*2] = glm::vec3(mass1->normal);
-            vboNor[i*2+1] = glm::vec3(mass2->normal);
+            int mass1 = springs->mass1[i];
+            int mass2 = springs->mass2[i];
+            vboPos[i*2] = glm::vec3(position[mass1]);
+            vboPos[i*2+1] = glm::vec3(position[mass2]);
+            vboNor[i*2] = glm::vec3(normal[mass1]);
+            vboNor[i*2+1] = glm::vec3(normal[mass2]);
         }
         
         glUseProgram(programID);
@@ -363,10 +373,10 @@ struct ClothSpringRender {
     ClothSpringRender(Cloth* c) {
         cloth = c;
         defaultColor = glm::vec4(1.0, 1.0, 1.0, 1.0);
-        render.init(cloth->springs, defaultColor, cloth->cloth_pos);
+        render.init(&cloth->masses, &cloth->springs, defaultColor, cloth->cloth_pos);
     }
     
-    void flush() { render.flush(); }
+    void flush(const glm::dvec3* position, const glm::dvec3* normal) { render.flush(position, normal); }
 };
 
 struct RigidRender {
@@ -3,6 +3,7 @@
 #include <math.h>
 
 #include <cmath>
+#include <cstdio>
 #include <vector>
 enum class RigidType {
     Ball,
@@ -0,0 +1,628 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "rigid.h"
+#include "thread_pool.h"
+
+// FNV-1a over the raw bytes, so any change in the last bit shows up
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Indexed triangles, counter-clockwise seen from outside once oriented
+struct TriangleMesh
+{
+    std::vector<glm::dvec3> vertices;
+    std::vector<glm::ivec3> triangles;
+
+    void bounds(glm::dvec3 &low, glm::dvec3 &high) const
+    {
+        low = glm::dvec3(std::numeric_limits<double>::infinity());
+        high = -low;
+        for (const glm::dvec3 &v : vertices)
+        {
+            low = glm::min(low, v);
+            high = glm::max(high, v);
+        }
+    }
+
+    /**
+     * Wind every triangle counter-clockwise seen from outside. Triangles
+     * sharing an edge are flipped to run it in opposite directions, then each
+     * connected part is turned outwards by the sign of its volume.
+     */
+    void orient()
+    {
+        std::unordered_map<uint64_t, std::vector<int>> edge_triangles;
+        for (int t = 0; t < (int)triangles.size(); t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                edge_triangles[undirected_edge(triangles[t][k], triangles[t][(k + 1) % 3])].push_back(t);
+            }
+        }
+        std::vector<int> part(triangles.size(), -1);
+        std::vector<int> queue;
+        for (int seed = 0; seed < (int)triangles.size(); seed++)
+        {
+            if (part[seed] >= 0)
+            {
+                continue;
+            }
+            part[seed] = seed;
+            queue.assign(1, seed);
+            double volume = 0.0;
+            for (size_t head = 0; head < queue.size(); head++)
+            {
+                const glm::ivec3 t = triangles[queue[head]];
+                volume += glm::dot(vertices[t.x], glm::cross(vertices[t.y], vertices[t.z]));
+                for (int k = 0; k < 3; k++)
+                {
+                    for (int other : edge_triangles[undirected_edge(t[k], t[(k + 1) % 3])])
+                    {
+                        if (part[other] >= 0)
+                        {
+                            continue;
+                        }
+                        // The neighbour runs the shared edge the same way round when it goes from t[k] to t[k + 1] too
+                        glm::ivec3 &u = triangles[other];
+                        for (int j = 0; j < 3; j++)
+                        {
+                            if (u[j] == t[k] && u[(j + 1) % 3] == t[(k + 1) % 3])
+                            {
+                                std::swap(u.y, u.z);
+                                break;
+                            }
+                        }
+                        part[other] = seed;
+                        queue.push_back(other);
+                    }
+                }
+            }
+            if (volume < 0.0)
+            {
+                for (int t : queue)
+                {
+                    std::swap(triangles[t].y, triangles[t].z);
+                }
+            }
+        }
+    }
+
+private:
+    static uint64_t undirected_edge(int a, int b)
+    {
+        return (uint64_t)std::min(a, b) << 32 | (uint32_t)std::max(a, b);
+    }
+};
+
+// Mesh of a rigid body, such as Sphere::vertexes and Sphere::faces
+inline TriangleMesh make_mesh(const std::vector<Vertex *> &vertices, const std::vector<Vertex *> &faces)
+{
+    TriangleMesh mesh;
+    std::unordered_map<const Vertex *, int> index;
+    for (const Vertex *vertex : vertices)
+    {
+        index[vertex] = (int)mesh.vertices.size();
+        mesh.vertices.push_back(vertex->position);
+    }
+    for (size_t k = 0; k + 2 < faces.size(); k += 3)
+    {
+        mesh.triangles.push_back(glm::ivec3(index[faces[k]], index[faces[k + 1]], index[faces[k + 2]]));
+    }
+    return mesh;
+}
+
+// Wavefront OBJ, only v and f lines; polygons become fans, texture and normal indices are ignored
+inline bool load_obj(const std::string &path, TriangleMesh &mesh)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cout << "ERROR::load_obj : Failed to open " << path << std::endl;
+        return false;
+    }
+    mesh = TriangleMesh();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line))
+    {
+        line_number++;
+        std::stringstream fields(line);
+        std::string type;
+        fields >> type;
+        if (type == "v")
+        {
+            glm::dvec3 v;
+            if (!(fields >> v.x >> v.y >> v.z))
+            {
+                std::cout << "ERROR::load_obj : " << path << ":" << line_number << ": bad vertex" << std::endl;
+                return false;
+            }
+            mesh.vertices.push_back(v);
+        }
+        else if (type == "f")
+        {
+            std::vector<int> polygon;
+            std::string corner;
+            while (fields >> corner)
+            {
+                // 1-based, negative counts back from the last vertex read so far
+                int k = atoi(corner.c_str());
+                k = k < 0 ? (int)mesh.vertices.size() + k : k - 1;
+                if (k < 0 || k >= (int)mesh.vertices.size())
+                {
+                    std::cout << "ERROR::load_obj : " << path << ":" << line_number << ": bad vertex index " << corner << std::endl;
+                    return false;
+                }
+                polygon.push_back(k);
+            }
+            for (size_t k = 2; k < polygon.size(); k++)
+            {
+                mesh.triangles.push_back(glm::ivec3(polygon[0], polygon[k - 1], polygon[k]));
+            }
+        }
+    }
+    if (mesh.triangles.empty())
+    {
+        std::cout << "ERROR::load_obj : " << path << ": no faces" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Signed distance to a closed triangle mesh, sampled on a regular grid and
+ * negative inside.
+ *
+ * Samples within band of the surface get the exact distance to the nearest
+ * triangle, signed by the angle-weighted pseudo-normal of its nearest
+ * feature (Baerentzen and Aanaes), so edges and corners get the right sign.
+ * The remaining samples are split into inside and outside by a flood fill
+ * from the grid border, which the negative band walls off, and get their
+ * distance from a chamfer sweep. A lookup is a trilinear interpolation of
+ * eight samples and its gradient, however many triangles the mesh has.
+ */
+class SignedDistanceField
+{
+public:
+    glm::dvec3 origin = glm::dvec3(0.0); // Position of sample (0, 0, 0)
+    double voxel_size = 1.0;
+    double band = 1.0;
+    glm::ivec3 dimension = glm::ivec3(0); // Samples along x, y and z
+    std::vector<float> values;            // x fastest, then y, then z
+    uint64_t key = 0;                     // Hash of the mesh and settings it was built from
+
+    static uint64_t key_of(const TriangleMesh &mesh, double voxel_size, double band)
+    {
+        uint64_t hash = fnv1a(mesh.vertices.data(), mesh.vertices.size() * sizeof(glm::dvec3));
+        hash = fnv1a(mesh.triangles.data(), mesh.triangles.size() * sizeof(glm::ivec3), hash);
+        hash = fnv1a(&voxel_size, sizeof(double), hash);
+        return fnv1a(&band, sizeof(double), hash);
+    }
+
+    glm::dvec3 low() const
+    {
+        return origin;
+    }
+
+    glm::dvec3 high() const
+    {
+        return origin + glm::dvec3(dimension - 1) * voxel_size;
+    }
+
+    /**
+     * Sample the mesh every _voxel_size. Distances are exact within _band of
+     * the surface, which is widened to two voxels if narrower so the inside
+     * stays sealed off from the flood fill. Triangles are binned into slabs
+     * of the grid along z and the slabs run on the pool.
+     */
+    void build(const TriangleMesh &source, double _voxel_size, double _band, ThreadPool *pool = nullptr)
+    {
+        key = key_of(source, _voxel_size, _band);
+        TriangleMesh mesh = source;
+        mesh.orient();
+        voxel_size = _voxel_size;
+        band = std::max(_band, 2.0 * _voxel_size);
+        glm::dvec3 mesh_low, mesh_high;
+        mesh.bounds(mesh_low, mesh_high);
+        const double pad = band + voxel_size;
+        origin = mesh_low - pad;
+        dimension = glm::ivec3(glm::ceil((mesh_high - mesh_low + 2.0 * pad) / voxel_size)) + 1;
+        const int count = dimension.x * dimension.y * dimension.z;
+        compute_pseudo_normals(mesh);
+
+        std::vector<double> distance(count, std::numeric_limits<double>::infinity());
+        const int slab = 4;
+        const int slabs = (dimension.z + slab - 1) / slab;
+        std::vector<std::vector<int>> slab_triangles(slabs);
+        std::vector<glm::ivec3> triangle_low(mesh.triangles.size());
+        std::vector<glm::ivec3> triangle_high(mesh.triangles.size());
+        for (int t = 0; t < (int)mesh.triangles.size(); t++)
+        {
+            const glm::ivec3 &tri = mesh.triangles[t];
+            glm::dvec3 a = mesh.vertices[tri.x], b = mesh.vertices[tri.y], c = mesh.vertices[tri.z];
+            triangle_low[t] = glm::max(glm::ivec3(glm::ceil((glm::min(a, glm::min(b, c)) - band - origin) / voxel_size)), glm::ivec3(0));
+            triangle_high[t] = glm::min(glm::ivec3(glm::floor((glm::max(a, glm::max(b, c)) + band - origin) / voxel_size)), dimension - 1);
+            for (int s = triangle_low[t].z / slab; s <= triangle_high[t].z / slab; s++)
+            {
+                slab_triangles[s].push_back(t);
+            }
+        }
+        parallel_for(pool, 0, slabs, 1, [&](int begin, int end) {
+            for (int s = begin; s < end; s++)
+            {
+                for (int t : slab_triangles[s])
+                {
+                    const glm::ivec3 &tri = mesh.triangles[t];
+                    for (int z = std::max(triangle_low[t].z, s * slab); z <= std::min(triangle_high[t].z, s * slab + slab - 1); z++)
+                    {
+                        for (int y = triangle_low[t].y; y <= triangle_high[t].y; y++)
+                        {
+                            for (int x = triangle_low[t].x; x <= triangle_high[t].x; x++)
+                            {
+                                glm::dvec3 p = origin + glm::dvec3(x, y, z) * voxel_size;
+                                double &d = distance[index(x, y, z)];
+                                double signed_distance = signed_distance_to(mesh, t, tri, p, std::abs(d));
+                                if (std::abs(signed_distance) < std::abs(d) && std::abs(signed_distance) <= band)
+                                {
+                                    d = signed_distance;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        fill_outside_band(distance);
+
+        values.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            values[i] = (float)distance[i];
+        }
+        edge_normal.clear();
+        vertex_normal.clear();
+        face_normal.clear();
+    }
+
+    // Trilinear distance at p and its gradient, false outside the grid
+    bool sample(const glm::dvec3 &p, double &distance, glm::dvec3 &gradient) const
+    {
+        // Points on the border of the grid may land a rounding error outside
+        const double slack = 1e-9;
+        const glm::dvec3 last = glm::dvec3(dimension - 1);
+        glm::dvec3 g = (p - origin) / voxel_size;
+        if (glm::any(glm::lessThan(g, glm::dvec3(-slack))) || glm::any(glm::greaterThan(g, last + slack)))
+        {
+            return false;
+        }
+        g = glm::clamp(g, glm::dvec3(0.0), last);
+        glm::ivec3 i = glm::min(glm::ivec3(g), dimension - 2);
+        glm::dvec3 f = g - glm::dvec3(i);
+        const float *v = values.data() + index(i.x, i.y, i.z);
+        const int dy = dimension.x;
+        const int dz = dimension.x * dimension.y;
+        // Along x first, then y, then z
+        double c00 = v[0] + (v[1] - v[0]) * f.x;
+        double c10 = v[dy] + (v[dy + 1] - v[dy]) * f.x;
+        double c01 = v[dz] + (v[dz + 1] - v[dz]) * f.x;
+        double c11 = v[dz + dy] + (v[dz + dy + 1] - v[dz + dy]) * f.x;
+        double c0 = c00 + (c10 - c00) * f.y;
+        double c1 = c01 + (c11 - c01) * f.y;
+        distance = c0 + (c1 - c0) * f.z;
+
+        double dx00 = v[1] - v[0];
+        double dx10 = v[dy + 1] - v[dy];
+        double dx01 = v[dz + 1] - v[dz];
+        double dx11 = v[dz + dy + 1] - v[dz + dy];
+        double dx0 = dx00 + (dx10 - dx00) * f.y;
+        double dx1 = dx01 + (dx11 - dx01) * f.y;
+        gradient.x = dx0 + (dx1 - dx0) * f.z;
+        gradient.y = (c10 - c00) + ((c11 - c01) - (c10 - c00)) * f.z;
+        gradient.z = c1 - c0;
+        gradient /= voxel_size;
+        return true;
+    }
+
+    bool save(const std::string &path) const
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        uint32_t version = file_version;
+        bool ok = fwrite(file_magic, 1, 8, file) == 8 && fwrite(&version, sizeof(version), 1, file) == 1 &&
+                  fwrite(&key, sizeof(key), 1, file) == 1 && fwrite(&origin, sizeof(origin), 1, file) == 1 &&
+                  fwrite(&voxel_size, sizeof(voxel_size), 1, file) == 1 && fwrite(&band, sizeof(band), 1, file) == 1 &&
+                  fwrite(&dimension, sizeof(dimension), 1, file) == 1 &&
+                  fwrite(values.data(), sizeof(float), values.size(), file) == values.size();
+        return fclose(file) == 0 && ok;
+    }
+
+    // False if the file is missing, from another version or cut short
+    bool load(const std::string &path)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        char magic[8];
+        uint32_t version = 0;
+        bool ok = fread(magic, 1, 8, file) == 8 && !memcmp(magic, file_magic, 8) && fread(&version, sizeof(version), 1, file) == 1 &&
+                  version == file_version && fread(&key, sizeof(key), 1, file) == 1 && fread(&origin, sizeof(origin), 1, file) == 1 &&
+                  fread(&voxel_size, sizeof(voxel_size), 1, file) == 1 && fread(&band, sizeof(band), 1, file) == 1 &&
+                  fread(&dimension, sizeof(dimension), 1, file) == 1 && glm::all(glm::greaterThan(dimension, glm::ivec3(1)));
+        if (ok)
+        {
+            values.resize((size_t)dimension.x * dimension.y * dimension.z);
+            ok = fread(values.data(), sizeof(float), values.size(), file) == values.size();
+        }
+        fclose(file);
+        return ok;
+    }
+
+private:
+    static constexpr const char *file_magic = "CLOTHSDF";
+    static constexpr uint32_t file_version = 1;
+
+    // Pseudo-normals of the mesh being built
+    std::vector<glm::dvec3> face_normal;
+    std::vector<glm::dvec3> vertex_normal;
+    std::unordered_map<uint64_t, glm::dvec3> edge_normal;
+
+    int index(int x, int y, int z) const
+    {
+        return (z * dimension.y + y) * dimension.x + x;
+    }
+
+    static uint64_t edge_key(int a, int b)
+    {
+        return (uint64_t)std::min(a, b) << 32 | (uint32_t)std::max(a, b);
+    }
+
+    // Zero for an edge of degenerate triangles only
+    glm::dvec3 edge_pseudo_normal(int a, int b) const
+    {
+        auto found = edge_normal.find(edge_key(a, b));
+        return found == edge_normal.end() ? glm::dvec3(0.0) : found->second;
+    }
+
+    // Faces by unit normal, edges by the sum of the two faces, vertices by the faces weighted with their angle there
+    void compute_pseudo_normals(const TriangleMesh &mesh)
+    {
+        face_normal.assign(mesh.triangles.size(), glm::dvec3(0.0));
+        vertex_normal.assign(mesh.vertices.size(), glm::dvec3(0.0));
+        edge_normal.clear();
+        for (size_t t = 0; t < mesh.triangles.size(); t++)
+        {
+            const glm::ivec3 &tri = mesh.triangles[t];
+            glm::dvec3 normal = glm::cross(mesh.vertices[tri.y] - mesh.vertices[tri.x], mesh.vertices[tri.z] - mesh.vertices[tri.x]);
+            double length = glm::length(normal);
+            if (length == 0.0)
+            {
+                continue;
+            }
+            normal /= length;
+            face_normal[t] = normal;
+            for (int k = 0; k < 3; k++)
+            {
+                glm::dvec3 p = mesh.vertices[tri[k]];
+                glm::dvec3 e1 = mesh.vertices[tri[(k + 1) % 3]] - p;
+                glm::dvec3 e2 = mesh.vertices[tri[(k + 2) % 3]] - p;
+                double angle = std::acos(glm::clamp(glm::dot(e1, e2) / (glm::length(e1) * glm::length(e2)), -1.0, 1.0));
+                vertex_normal[tri[k]] += angle * normal;
+                edge_normal[edge_key(tri[k], tri[(k + 1) % 3])] += normal;
+            }
+        }
+    }
+
+    /**
+     * Distance from p to triangle t, signed by the pseudo-normal of its nearest
+     * feature. Returns the unsigned distance when it is not below limit, so
+     * far triangles skip the sign.
+     */
+    double signed_distance_to(const TriangleMesh &mesh, int t, const glm::ivec3 &tri, const glm::dvec3 &p, double limit) const
+    {
+        // Closest point by Voronoi region of the triangle (Ericson, Real-Time Collision Detection 5.1.5)
+        const glm::dvec3 a = mesh.vertices[tri.x], b = mesh.vertices[tri.y], c = mesh.vertices[tri.z];
+        const glm::dvec3 ab = b - a, ac = c - a, ap = p - a;
+        glm::dvec3 closest;
+        glm::dvec3 normal;
+        double d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+        glm::dvec3 bp = p - b;
+        double d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+        glm::dvec3 cp = p - c;
+        double d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        double vc = d1 * d4 - d3 * d2;
+        double vb = d5 * d2 - d1 * d6;
+        double va = d3 * d6 - d5 * d4;
+        if (d1 <= 0.0 && d2 <= 0.0)
+        {
+            closest = a;
+            normal = vertex_normal[tri.x];
+        }
+        else if (d3 >= 0.0 && d4 <= d3)
+        {
+            closest = b;
+            normal = vertex_normal[tri.y];
+        }
+        else if (d6 >= 0.0 && d5 <= d6)
+        {
+            closest = c;
+            normal = vertex_normal[tri.z];
+        }
+        else if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+        {
+            closest = a + ab * (d1 / (d1 - d3));
+            normal = edge_pseudo_normal(tri.x, tri.y);
+        }
+        else if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+        {
+            closest = a + ac * (d2 / (d2 - d6));
+            normal = edge_pseudo_normal(tri.x, tri.z);
+        }
+        else if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0)
+        {
+            closest = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+            normal = edge_pseudo_normal(tri.y, tri.z);
+        }
+        else
+        {
+            double denominator = 1.0 / (va + vb + vc);
+            closest = a + ab * (vb * denominator) + ac * (vc * denominator);
+            normal = face_normal[t];
+        }
+        double distance = glm::length(p - closest);
+        if (distance >= limit)
+        {
+            return distance;
+        }
+        return glm::dot(p - closest, normal) < 0.0 ? -distance : distance;
+    }
+
+    // Sign the samples outside the band by a flood fill from the border, then spread distances into them
+    void fill_outside_band(std::vector<double> &distance) const
+    {
+        const int count = (int)distance.size();
+        std::vector<unsigned char> exact(count);
+        std::vector<unsigned char> outside(count, 0);
+        std::vector<int> queue;
+        for (int i = 0; i < count; i++)
+        {
+            exact[i] = std::isfinite(distance[i]);
+        }
+        for (int z = 0; z < dimension.z; z++)
+        {
+            for (int y = 0; y < dimension.y; y++)
+            {
+                for (int x = 0; x < dimension.x; x++)
+                {
+                    bool border = x == 0 || y == 0 || z == 0 || x == dimension.x - 1 || y == dimension.y - 1 || z == dimension.z - 1;
+                    int i = index(x, y, z);
+                    if (border && !(exact[i] && distance[i] < 0.0))
+                    {
+                        outside[i] = 1;
+                        queue.push_back(i);
+                    }
+                }
+            }
+        }
+        const int step[6] = {1, -1, dimension.x, -dimension.x, dimension.x * dimension.y, -dimension.x * dimension.y};
+        for (size_t head = 0; head < queue.size(); head++)
+        {
+            int i = queue[head];
+            int x = i % dimension.x, y = i / dimension.x % dimension.y, z = i / (dimension.x * dimension.y);
+            bool inside_grid[6] = {x + 1 < dimension.x, x > 0, y + 1 < dimension.y, y > 0, z + 1 < dimension.z, z > 0};
+            for (int k = 0; k < 6; k++)
+            {
+                int j = i + step[k];
+                if (inside_grid[k] && !outside[j] && !(exact[j] && distance[j] < 0.0))
+                {
+                    outside[j] = 1;
+                    queue.push_back(j);
+                }
+            }
+        }
+
+        // Two-pass chamfer over the 26 neighbours, half of them behind the sweep in each pass
+        std::vector<double> magnitude(count);
+        for (int i = 0; i < count; i++)
+        {
+            magnitude[i] = std::abs(distance[i]);
+        }
+        for (int pass = 0; pass < 2; pass++)
+        {
+            const int direction = pass == 0 ? 1 : -1;
+            for (int z = pass == 0 ? 0 : dimension.z - 1; z >= 0 && z < dimension.z; z += direction)
+            {
+                for (int y = pass == 0 ? 0 : dimension.y - 1; y >= 0 && y < dimension.y; y += direction)
+                {
+                    for (int x = pass == 0 ? 0 : dimension.x - 1; x >= 0 && x < dimension.x; x += direction)
+                    {
+                        int i = index(x, y, z);
+                        if (exact[i])
+                        {
+                            continue;
+                        }
+                        double best = magnitude[i];
+                        for (int dz = -1; dz <= 0; dz++)
+                        {
+                            for (int dy = -1; dy <= 1; dy++)
+                            {
+                                for (int dx = -1; dx <= 1; dx++)
+                                {
+                                    // Neighbours already swept: lower z, or same z and lower y, or same row and lower x
+                                    if ((dz == 0 && dy > 0) || (dz == 0 && dy == 0 && dx >= 0))
+                                    {
+                                        continue;
+                                    }
+                                    int nx = x + dx * direction, ny = y + dy * direction, nz = z + dz * direction;
+                                    if (nx < 0 || ny < 0 || nz < 0 || nx >= dimension.x || ny >= dimension.y || nz >= dimension.z)
+                                    {
+                                        continue;
+                                    }
+                                    best = std::min(best, magnitude[index(nx, ny, nz)] + voxel_size * std::sqrt((double)(dx * dx + dy * dy + dz * dz)));
+                                }
+                            }
+                        }
+                        magnitude[i] = best;
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (!exact[i])
+            {
+                distance[i] = outside[i] ? magnitude[i] : -magnitude[i];
+            }
+        }
+    }
+};
+
+/**
+ * Field of a mesh, read from cache_path when that file was built from the same
+ * mesh, voxel size and band, otherwise built and written there. An empty
+ * cache_path always builds.
+ */
+inline std::shared_ptr<const SignedDistanceField> cached_sdf(const TriangleMesh &mesh, double voxel_size, double band,
+                                                             const std::string &cache_path, ThreadPool *pool = nullptr)
+{
+    std::shared_ptr<SignedDistanceField> field = std::make_shared<SignedDistanceField>();
+    if (!cache_path.empty() && field->load(cache_path) && field->key == SignedDistanceField::key_of(mesh, voxel_size, band))
+    {
+        return field;
+    }
+    field->build(mesh, voxel_size, band, pool);
+    if (!cache_path.empty() && !field->save(cache_path))
+    {
+        std::cout << "ERROR::cached_sdf : Failed to write " << cache_path << std::endl;
+    }
+    return field;
+}
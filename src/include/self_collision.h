@@ -0,0 +1,517 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mass.h"
+#include "thread_pool.h"
+
+/**
+ * Point-triangle self-collision of a cloth with thickness.
+ * Every call finds the masses closer than thickness to the interior of a
+ * triangle of other masses and pushes them back to the side they were on at
+ * the start of the step. Corrections are split by inverse mass between the
+ * mass and the triangle corners.
+ *
+ * The triangles come grouped into tiles of nearby triangles. A patch whose
+ * normals all lie within 90 degrees of one direction projects one-to-one onto
+ * the plane of that direction, so it cannot fold onto itself; tiles that are
+ * flat and only come near their flat, aligned neighbours are skipped as a
+ * whole. The masses of the remaining tiles are sorted into a uniform grid that
+ * the triangles of those tiles query. Every tile writes its own contact list
+ * on the thread pool and the contacts are resolved in tile order as a Jacobi
+ * sweep, so the result does not depend on the thread count.
+ */
+class SelfCollision
+{
+public:
+    int contacts = 0;     // Found by the last resolve
+    int active_tiles = 0; // Tiles whose triangles were queried by the last resolve
+
+    // Tile t holds the triangles [tile_begin[t], tile_begin[t + 1]) of faces
+    void resolve(Masses &masses, const std::vector<int> &faces, const std::vector<int> &tile_begin,
+                 double thickness, double cell_size, int iterations, ThreadPool *pool)
+    {
+        const int tiles = (int)tile_begin.size() - 1;
+        if ((int)tile_neighbours.size() != tiles || (int)mass_tile.size() != masses.size())
+        {
+            build_topology(masses.size(), faces, tile_begin);
+        }
+        parallel_for(pool, 0, tiles, 4, [&](int begin, int end) {
+            for (int t = begin; t < end; t++)
+            {
+                bound_tile(masses.position, faces, tile_begin, t, thickness);
+            }
+        });
+        mark_active_tiles();
+        contacts = 0;
+        if (active_tiles == 0)
+        {
+            return;
+        }
+
+        build_grid(masses.position, cell_size, pool);
+        tile_contacts.resize(tiles);
+        parallel_for(pool, 0, tiles, 1, [&](int begin, int end) {
+            for (int t = begin; t < end; t++)
+            {
+                tile_contacts[t].clear();
+                if (!tile_active[t])
+                {
+                    continue;
+                }
+                for (int triangle = tile_begin[t]; triangle < tile_begin[t + 1]; triangle++)
+                {
+                    find_contacts(masses, faces, t, triangle, thickness, tile_contacts[t]);
+                }
+            }
+        });
+        for (const auto &list : tile_contacts)
+        {
+            contacts += (int)list.size();
+        }
+        if (contacts == 0)
+        {
+            return;
+        }
+
+        for (int iteration = 0; iteration < iterations; iteration++)
+        {
+            project_positions(masses, thickness, pool);
+        }
+        remove_approach_velocity(masses, pool);
+    }
+
+private:
+    struct Contact
+    {
+        int mass;
+        int corner[3];
+        double weight[3];  // Barycentric coordinates of the closest point
+        glm::dvec3 normal; // Towards the side the mass belongs on
+    };
+
+    // Normals of a flat tile lie within 30 degrees of its mean, and flat neighbours
+    // are joined when their means lie within 30 degrees of each other too, so two
+    // joined tiles stay well inside the 90 degree bound
+    const double flat_cosine = std::cos(glm::radians(30.0));
+
+    // Topology, rebuilt when the faces change
+    std::vector<int> mass_tile;                     // Tile that owns the mass, the first one using it
+    std::vector<std::vector<int>> tile_neighbours;  // Tiles sharing a mass with the tile, sorted
+    std::vector<int> tile_masses_begin;             // Masses owned by tile t are tile_masses[tile_masses_begin[t], tile_masses_begin[t + 1])
+    std::vector<int> tile_masses;
+    // Per tile, every resolve
+    std::vector<glm::dvec3> tile_low;               // Bounds of the tile grown by thickness
+    std::vector<glm::dvec3> tile_high;
+    std::vector<glm::dvec3> tile_normal;            // Mean normal
+    std::vector<unsigned char> tile_flat;
+    std::vector<unsigned char> tile_active;
+    std::vector<std::vector<int>> tile_joined;      // Tiles whose masses the triangles of the tile skip
+    std::vector<int> tile_order;
+    // Uniform grid over the masses of the active tiles
+    double inverse_cell = 1.0;
+    glm::dvec3 origin = glm::dvec3(0.0);
+    glm::ivec3 dimension = glm::ivec3(1);
+    std::vector<int> grid_masses;
+    std::vector<int> mass_cell;                     // Cell of grid_masses[i]
+    std::vector<int> cell_start;                    // Masses of cell c are cell_masses[cell_start[c], cell_start[c + 1])
+    std::vector<int> cell_fill;
+    std::vector<int> cell_masses;
+    std::vector<int> cell_tile;                     // Tile and position of cell_masses[k], in cell order
+    std::vector<glm::dvec3> cell_position;          // so a query reads them contiguously
+    // Contacts and the Jacobi sweep
+    std::vector<std::vector<Contact>> tile_contacts;
+    std::vector<glm::dvec3> delta;
+    std::vector<int> delta_count;
+
+    void build_topology(int mass_count, const std::vector<int> &faces, const std::vector<int> &tile_begin)
+    {
+        const int tiles = (int)tile_begin.size() - 1;
+        mass_tile.assign(mass_count, -1);
+        std::vector<std::vector<int>> mass_tiles(mass_count);
+        for (int t = 0; t < tiles; t++)
+        {
+            for (int k = 3 * tile_begin[t]; k < 3 * tile_begin[t + 1]; k++)
+            {
+                int m = faces[k];
+                if (mass_tile[m] < 0)
+                {
+                    mass_tile[m] = t;
+                }
+                if (mass_tiles[m].empty() || mass_tiles[m].back() != t)
+                {
+                    mass_tiles[m].push_back(t);
+                }
+            }
+        }
+        tile_neighbours.assign(tiles, std::vector<int>());
+        for (const auto &shared : mass_tiles)
+        {
+            for (int a : shared)
+            {
+                for (int b : shared)
+                {
+                    if (a != b)
+                    {
+                        tile_neighbours[a].push_back(b);
+                    }
+                }
+            }
+        }
+        for (auto &neighbours : tile_neighbours)
+        {
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        }
+        tile_masses_begin.assign(tiles + 1, 0);
+        for (int m = 0; m < mass_count; m++)
+        {
+            if (mass_tile[m] >= 0)
+            {
+                tile_masses_begin[mass_tile[m] + 1]++;
+            }
+        }
+        for (int t = 0; t < tiles; t++)
+        {
+            tile_masses_begin[t + 1] += tile_masses_begin[t];
+        }
+        tile_masses.resize(tile_masses_begin[tiles]);
+        std::vector<int> fill(tile_masses_begin.begin(), tile_masses_begin.end() - 1);
+        for (int m = 0; m < mass_count; m++)
+        {
+            if (mass_tile[m] >= 0)
+            {
+                tile_masses[fill[mass_tile[m]]++] = m;
+            }
+        }
+        tile_low.resize(tiles);
+        tile_high.resize(tiles);
+        tile_normal.resize(tiles);
+        tile_flat.resize(tiles);
+        tile_active.resize(tiles);
+        tile_joined.resize(tiles);
+        tile_contacts.clear();
+    }
+
+    void bound_tile(const std::vector<glm::dvec3> &position, const std::vector<int> &faces, const std::vector<int> &tile_begin, int t, double thickness)
+    {
+        glm::dvec3 low(INFINITY);
+        glm::dvec3 high(-INFINITY);
+        glm::dvec3 sum(0.0);
+        for (int triangle = tile_begin[t]; triangle < tile_begin[t + 1]; triangle++)
+        {
+            const glm::dvec3 &a = position[faces[3 * triangle + 0]];
+            const glm::dvec3 &b = position[faces[3 * triangle + 1]];
+            const glm::dvec3 &c = position[faces[3 * triangle + 2]];
+            low = glm::min(low, glm::min(a, glm::min(b, c)));
+            high = glm::max(high, glm::max(a, glm::max(b, c)));
+            sum += glm::cross(b - a, c - a);
+        }
+        tile_low[t] = low - thickness;
+        tile_high[t] = high + thickness;
+
+        double length = glm::length(sum);
+        bool flat = length > 0.0;
+        glm::dvec3 mean = flat ? sum / length : glm::dvec3(0.0);
+        for (int triangle = tile_begin[t]; flat && triangle < tile_begin[t + 1]; triangle++)
+        {
+            const glm::dvec3 &a = position[faces[3 * triangle + 0]];
+            glm::dvec3 normal = glm::cross(position[faces[3 * triangle + 1]] - a, position[faces[3 * triangle + 2]] - a);
+            flat = glm::dot(normal, mean) >= flat_cosine * glm::length(normal);
+        }
+        tile_normal[t] = mean;
+        tile_flat[t] = flat;
+    }
+
+    bool joined(int a, int b) const
+    {
+        if (!tile_flat[a] || !tile_flat[b])
+        {
+            return false;
+        }
+        if (a == b)
+        {
+            return true;
+        }
+        const auto &neighbours = tile_neighbours[a];
+        return glm::dot(tile_normal[a], tile_normal[b]) >= flat_cosine && std::binary_search(neighbours.begin(), neighbours.end(), b);
+    }
+
+    // Sweep and prune over the tile bounds along x: a tile is active when it
+    // overlaps a tile it is not joined with, itself included when it is curved
+    void mark_active_tiles()
+    {
+        const int tiles = (int)tile_low.size();
+        tile_order.resize(tiles);
+        for (int t = 0; t < tiles; t++)
+        {
+            tile_order[t] = t;
+            tile_active[t] = !tile_flat[t];
+            tile_joined[t].clear();
+        }
+        std::sort(tile_order.begin(), tile_order.end(), [&](int a, int b) { return tile_low[a].x < tile_low[b].x; });
+        for (int i = 0; i < tiles; i++)
+        {
+            const int a = tile_order[i];
+            for (int j = i + 1; j < tiles && tile_low[tile_order[j]].x <= tile_high[a].x; j++)
+            {
+                const int b = tile_order[j];
+                if (tile_low[b].y > tile_high[a].y || tile_high[b].y < tile_low[a].y ||
+                    tile_low[b].z > tile_high[a].z || tile_high[b].z < tile_low[a].z || joined(a, b))
+                {
+                    continue;
+                }
+                tile_active[a] = 1;
+                tile_active[b] = 1;
+            }
+        }
+        active_tiles = 0;
+        for (int t = 0; t < tiles; t++)
+        {
+            if (!tile_active[t])
+            {
+                continue;
+            }
+            active_tiles++;
+            if (tile_flat[t])
+            {
+                tile_joined[t].push_back(t);
+            }
+            for (int b : tile_neighbours[t])
+            {
+                if (joined(t, b))
+                {
+                    tile_joined[t].push_back(b);
+                }
+            }
+        }
+    }
+
+    glm::ivec3 cell_of(const glm::dvec3 &p) const
+    {
+        glm::ivec3 cell = glm::ivec3(glm::floor((p - origin) * inverse_cell));
+        return glm::clamp(cell, glm::ivec3(0), dimension - 1);
+    }
+
+    int index_of(const glm::ivec3 &cell) const
+    {
+        return cell.x + dimension.x * (cell.y + dimension.y * cell.z);
+    }
+
+    /**
+     * Counting sort of the masses of the active tiles by cell. A dense grid
+     * instead of a hash keeps neighbouring cells next to each other in memory;
+     * the cells are widened when the bounding box would need more than 32 per
+     * mass. A triangle can only come near masses of tiles it overlaps, which
+     * are either joined with its tile or active themselves.
+     */
+    void build_grid(const std::vector<glm::dvec3> &position, double cell_size, ThreadPool *pool)
+    {
+        grid_masses.clear();
+        const int tiles = (int)tile_low.size();
+        for (int t = 0; t < tiles; t++)
+        {
+            if (tile_active[t])
+            {
+                grid_masses.insert(grid_masses.end(), tile_masses.begin() + tile_masses_begin[t], tile_masses.begin() + tile_masses_begin[t + 1]);
+            }
+        }
+        const int n = (int)grid_masses.size();
+        glm::dvec3 low(INFINITY);
+        glm::dvec3 high(-INFINITY);
+        for (int m : grid_masses)
+        {
+            low = glm::min(low, position[m]);
+            high = glm::max(high, position[m]);
+        }
+        const glm::dvec3 extent = high - low;
+        for (;;)
+        {
+            glm::dvec3 cells = glm::floor(extent / cell_size) + 1.0;
+            if (cells.x * cells.y * cells.z <= 32.0 * std::max(n, 64))
+            {
+                dimension = glm::ivec3(cells);
+                break;
+            }
+            cell_size *= 1.5;
+        }
+        origin = low;
+        inverse_cell = 1.0 / cell_size;
+        const int cell_count = dimension.x * dimension.y * dimension.z;
+
+        mass_cell.resize(n);
+        parallel_for(pool, 0, n, 4096, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                mass_cell[i] = index_of(cell_of(position[grid_masses[i]]));
+            }
+        });
+
+        cell_start.assign(cell_count + 1, 0);
+        for (int i = 0; i < n; i++)
+        {
+            cell_start[mass_cell[i] + 1]++;
+        }
+        for (int c = 0; c < cell_count; c++)
+        {
+            cell_start[c + 1] += cell_start[c];
+        }
+        cell_fill.assign(cell_start.begin(), cell_start.end() - 1);
+        cell_masses.resize(n);
+        cell_tile.resize(n);
+        cell_position.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            int k = cell_fill[mass_cell[i]]++;
+            int m = grid_masses[i];
+            cell_masses[k] = m;
+            cell_tile[k] = mass_tile[m];
+            cell_position[k] = position[m];
+        }
+    }
+
+    void find_contacts(const Masses &masses, const std::vector<int> &faces, int tile, int triangle, double thickness, std::vector<Contact> &out) const
+    {
+        const glm::dvec3 *position = masses.position.data();
+        const glm::dvec3 *last_position = masses.last_position.data();
+        const int ia = faces[3 * triangle + 0];
+        const int ib = faces[3 * triangle + 1];
+        const int ic = faces[3 * triangle + 2];
+        const glm::dvec3 a = position[ia];
+        const glm::dvec3 e1 = position[ib] - a;
+        const glm::dvec3 e2 = position[ic] - a;
+        glm::dvec3 normal = glm::cross(e1, e2);
+        double length = glm::length(normal);
+        if (length <= 0.0)
+        {
+            return;
+        }
+        normal /= length;
+        const double d00 = glm::dot(e1, e1);
+        const double d01 = glm::dot(e1, e2);
+        const double d11 = glm::dot(e2, e2);
+        const double inverse_denominator = 1.0 / (d00 * d11 - d01 * d01);
+        // Orientation of the triangle at the start of the step
+        const glm::dvec3 last_a = last_position[ia];
+        const glm::dvec3 last_normal = glm::cross(last_position[ib] - last_a, last_position[ic] - last_a);
+        const std::vector<int> &skip = tile_joined[tile];
+
+        const glm::dvec3 margin(thickness);
+        const glm::dvec3 box_low = glm::min(a, glm::min(position[ib], position[ic])) - margin;
+        const glm::dvec3 box_high = glm::max(a, glm::max(position[ib], position[ic])) + margin;
+        const glm::ivec3 low = cell_of(box_low);
+        const glm::ivec3 high = cell_of(box_high);
+        for (int z = low.z; z <= high.z; z++)
+        {
+            for (int y = low.y; y <= high.y; y++)
+            {
+                // Cells along x are contiguous, so a row of cells is one range of masses
+                const int row = index_of(glm::ivec3(0, y, z));
+                for (int k = cell_start[row + low.x]; k < cell_start[row + high.x + 1]; k++)
+                {
+                    const glm::dvec3 p = cell_position[k];
+                    if (p.x < box_low.x || p.x > box_high.x || p.y < box_low.y || p.y > box_high.y || p.z < box_low.z || p.z > box_high.z)
+                    {
+                        continue;
+                    }
+                    const int m = cell_masses[k];
+                    if (m == ia || m == ib || m == ic || std::find(skip.begin(), skip.end(), cell_tile[k]) != skip.end())
+                    {
+                        continue;
+                    }
+                    const glm::dvec3 ap = p - a;
+                    const double distance = glm::dot(ap, normal);
+                    if (std::abs(distance) >= thickness)
+                    {
+                        continue;
+                    }
+                    const double d20 = glm::dot(ap, e1);
+                    const double d21 = glm::dot(ap, e2);
+                    const double v = (d11 * d20 - d01 * d21) * inverse_denominator;
+                    const double w = (d00 * d21 - d01 * d20) * inverse_denominator;
+                    const double u = 1.0 - v - w;
+                    if (u < 0.0 || v < 0.0 || w < 0.0)
+                    {
+                        continue;
+                    }
+                    double side = glm::dot(last_position[m] - last_a, last_normal);
+                    bool below = side < 0.0 || (side == 0.0 && distance < 0.0);
+                    out.push_back({m, {ia, ib, ic}, {u, v, w}, below ? -normal : normal});
+                }
+            }
+        }
+    }
+
+    // Add the correction of every mass to delta, then move each mass by the average of its corrections
+    template <class Correction>
+    void jacobi_sweep(Masses &masses, std::vector<glm::dvec3> &target, ThreadPool *pool, Correction &&correction)
+    {
+        const int n = masses.size();
+        const double *inv_m = masses.inv_m.data();
+        delta.assign(n, glm::dvec3(0.0));
+        delta_count.assign(n, 0);
+        for (const auto &list : tile_contacts)
+        {
+            for (const Contact &c : list)
+            {
+                double weight_sum = inv_m[c.mass];
+                for (int k = 0; k < 3; k++)
+                {
+                    weight_sum += c.weight[k] * c.weight[k] * inv_m[c.corner[k]];
+                }
+                double s;
+                if (weight_sum <= 0.0 || !correction(c, s))
+                {
+                    continue;
+                }
+                s /= weight_sum;
+                delta[c.mass] += s * inv_m[c.mass] * c.normal;
+                delta_count[c.mass]++;
+                for (int k = 0; k < 3; k++)
+                {
+                    delta[c.corner[k]] -= s * c.weight[k] * inv_m[c.corner[k]] * c.normal;
+                    delta_count[c.corner[k]]++;
+                }
+            }
+        }
+        glm::dvec3 *out = target.data();
+        parallel_for(pool, 0, n, 4096, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                if (delta_count[i] > 0)
+                {
+                    out[i] += delta[i] / (double)delta_count[i];
+                }
+            }
+        });
+    }
+
+    // Push every mass that is closer than thickness back out along the contact normal
+    void project_positions(Masses &masses, double thickness, ThreadPool *pool)
+    {
+        const glm::dvec3 *position = masses.position.data();
+        jacobi_sweep(masses, masses.position, pool, [&](const Contact &c, double &s) {
+            glm::dvec3 closest = c.weight[0] * position[c.corner[0]] + c.weight[1] * position[c.corner[1]] + c.weight[2] * position[c.corner[2]];
+            double gap = glm::dot(position[c.mass] - closest, c.normal) - thickness;
+            s = -gap;
+            return gap < 0.0;
+        });
+    }
+
+    // Inelastic contacts: cancel the relative velocity that still closes the gap
+    void remove_approach_velocity(Masses &masses, ThreadPool *pool)
+    {
+        const glm::dvec3 *velocity = masses.velocity.data();
+        jacobi_sweep(masses, masses.velocity, pool, [&](const Contact &c, double &s) {
+            glm::dvec3 surface = c.weight[0] * velocity[c.corner[0]] + c.weight[1] * velocity[c.corner[1]] + c.weight[2] * velocity[c.corner[2]];
+            double approach = glm::dot(velocity[c.mass] - surface, c.normal);
+            s = -approach;
+            return approach < 0.0;
+        });
+    }
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cloth.h"
+#include "collider.h"
+#include "driver.h"
+
+/**
+ * Lock-free triple buffer for one writer and one reader thread.
+ * The writer fills write_buffer and publishes it, the reader takes the most
+ * recently published buffer with consume. Neither side ever waits: the slot
+ * between them is swapped with a single atomic exchange.
+ */
+template <class T>
+class TripleBuffer
+{
+public:
+    T &write_buffer() { return slots[back]; }
+
+    void publish()
+    {
+        back = middle.exchange(back | fresh, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Take the latest published buffer, false if nothing new was published since the last call
+    bool consume()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & fresh))
+        {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    const T &read_buffer() const { return slots[front]; }
+
+private:
+    static constexpr int fresh = 4;
+    static constexpr int index_mask = 3;
+    T slots[3];
+    int back = 0;
+    std::atomic<int> middle{1};
+    int front = 2;
+};
+
+/**
+ * Bounded lock-free queue for one producer and one consumer thread.
+ * push fails instead of blocking when the queue is full.
+ */
+template <class T, unsigned Capacity>
+class SpscQueue
+{
+public:
+    bool push(const T &item)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+        items[t % Capacity] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = items[h % Capacity];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[Capacity];
+    std::atomic<unsigned> head{0};
+    std::atomic<unsigned> tail{0};
+};
+
+// State of the cloth handed to the renderer after every simulated frame
+struct ClothFrame
+{
+    std::vector<glm::dvec3> position;
+    std::vector<glm::dvec3> normal;
+    long frame = 0;
+};
+
+// User input, applied by the simulation thread before its next frame
+struct ClothInput
+{
+    enum Kind
+    {
+        Wind,        // Blow on the masses near a screen position
+        Reset,
+        Collider,    // Switch the scene the cloth collides with
+        Constraint,  // Toggle the overstretch constraint
+        SelfCollision,
+        Sleeping,    // Toggle putting still tiles of the cloth to sleep
+        ReportProfile
+    };
+
+    Kind kind = Reset;
+    // Wind
+    glm::mat4 view_projection = glm::mat4(1.0f);
+    glm::dvec2 mouse = glm::dvec2(0.0);
+    glm::dvec2 screen = glm::dvec2(0.0);
+    glm::dvec3 force = glm::dvec3(0.0);
+    double radius = 0.0;
+    // Collider, the scene must outlive the simulation thread and stay unchanged while it is in use
+    const ColliderScene *scene = nullptr;
+    // Constraint, SelfCollision and Sleeping
+    bool enabled = true;
+};
+
+/**
+ * Steps a cloth on its own thread at a fixed rate, so a slow render frame
+ * does not slow the simulation down and the other way round. After every
+ * frame the positions and normals are published through a triple buffer;
+ * input arrives through a queue, the GUI thread never touches the cloth.
+ */
+class SimulationThread
+{
+public:
+    Cloth &cloth;
+    Profiler *profiler = nullptr;
+
+    SimulationThread(Cloth &_cloth)
+        : cloth(_cloth) {}
+
+    ~SimulationThread()
+    {
+        stop();
+    }
+
+    // Start stepping with the given method ("Euler", "RK", "RK45", "VERLET", "IMPLICIT" or "XPBD") every frame_period seconds,
+    // false for an unknown method
+    bool start(const std::string &_method, double frame_period = 1.0 / 60.0)
+    {
+        if (!is_step_method(_method))
+        {
+            std::cout << "ERROR::SimulationThread : Unknown method " << _method << std::endl;
+            return false;
+        }
+        method = _method;
+        period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(frame_period));
+        publish(0);
+        running.store(true, std::memory_order_release);
+        thread = std::thread([this]() { run(); });
+        return true;
+    }
+
+    void stop()
+    {
+        running.store(false, std::memory_order_release);
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    // Queue input for the next frame, false if the queue is full and the input was dropped
+    bool post(const ClothInput &input)
+    {
+        return inputs.push(input);
+    }
+
+    // Latest published frame, for the render thread only
+    const ClothFrame &latest()
+    {
+        frames.consume();
+        return frames.read_buffer();
+    }
+
+private:
+    std::string method;
+    std::chrono::steady_clock::duration period;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    TripleBuffer<ClothFrame> frames;
+    SpscQueue<ClothInput, 1024> inputs;
+    const ColliderScene *scene = nullptr;
+    bool constraint = true;
+
+    void run()
+    {
+        long frame = 0;
+        auto next = std::chrono::steady_clock::now();
+        while (running.load(std::memory_order_acquire))
+        {
+            {
+                TraceScope trace("simulation frame", "frame");
+                apply_inputs();
+                // A frame covers FRAME_TIME, in as many steps as the headless runs take at this resolution
+                const int substeps = substeps_per_frame(method, cloth.mass_per_row);
+                for (int i = 0; i < substeps; i++)
+                {
+                    step_cloth(cloth, method, constraint, scene, FRAME_TIME / substeps);
+                }
+                cloth.compute_normal();
+                publish(++frame);
+            }
+
+            // Fixed rate; after falling behind, continue from now instead of catching up
+            next += period;
+            auto now = std::chrono::steady_clock::now();
+            if (next < now)
+            {
+                next = now;
+            }
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    void publish(long frame)
+    {
+        ClothFrame &out = frames.write_buffer();
+        out.position = cloth.masses.position;
+        out.normal = cloth.masses.normal;
+        out.frame = frame;
+        frames.publish();
+    }
+
+    void apply_inputs()
+    {
+        ClothInput input;
+        while (inputs.pop(input))
+        {
+            switch (input.kind)
+            {
+            case ClothInput::Wind:
+                apply_wind(input);
+                break;
+            case ClothInput::Reset:
+                cloth.reset();
+                break;
+            case ClothInput::Collider:
+                scene = input.scene;
+                break;
+            case ClothInput::Constraint:
+                constraint = input.enabled;
+                break;
+            case ClothInput::SelfCollision:
+                cloth.self_collision = input.enabled;
+                break;
+            case ClothInput::Sleeping:
+                cloth.sleeping = input.enabled;
+                break;
+            case ClothInput::ReportProfile:
+                if (profiler != nullptr)
+                {
+                    profiler->report(std::cout);
+                }
+                break;
+            }
+        }
+    }
+
+    // Push the masses within radius pixels of the mouse, fading with a cosine of the distance
+    void apply_wind(const ClothInput &input)
+    {
+        const glm::dvec3 cloth_pos = cloth.cloth_pos;
+        for (int i = 0; i < cloth.masses.size(); i++)
+        {
+            glm::dvec3 mass_position = cloth_pos + cloth.masses.last_position[i];
+
+            // Transform the mass's world coordinates to screen space via clip space and NDC space
+            glm::vec4 clip_position = input.view_projection * glm::vec4(glm::vec3(mass_position), 1.0f);
+            glm::vec3 ndc_position = glm::vec3(clip_position) / clip_position.w;
+            glm::dvec2 screen_position((ndc_position.x + 1.0) / 2.0 * input.screen.x,
+                                       (1.0 - ndc_position.y) / 2.0 * input.screen.y);
+
+            double distance = glm::length(screen_position - input.mouse);
+            if (distance < input.radius)
+            {
+                double decay = distance <= 0.0 ? 1.0 : std::cos(distance / input.radius);
+                cloth.masses.force[i] += input.force * decay * cloth.masses.m[i];
+            }
+        }
+    }
+};
@@ -1,37 +1,164 @@
-#ifndef SPRING_H
-#define SPRING_H
-
-#include "mass.h"
-#include <glm/glm.hpp>
-#include <vector>
-
-
-class Spring {
-public:
-    Mass*  mass1;
-    Mass*  mass2;
-    double max_len;
-	double rest_len;
-    double spring_constant;
-
-    enum SpringType{
-        STRUCTURAL,
-        SHEAR,
-        FLEXION
-    };
-    SpringType spring_type;
-
-    
-	Spring(Mass* m1, Mass* m2, double k, SpringType _spring_type)
-        : mass1(m1), mass2(m2), spring_constant(k), spring_type(_spring_type) {
-
-        rest_len = glm::length(mass2->position - mass1->position);
-        max_len = rest_len * 1.1;
-	}
-
-    double get_length() {
-        return glm::length(mass2->position - mass1->position);
-    }
-};
-
-#endif // SPRING_H
+#ifndef SPRING_H
+#define SPRING_H
+
+#include "mass.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+
+
+// A single spring as it is linked. The simulation never reads these
+// directly, they are packed into a Springs table first.
+struct Spring {
+    enum SpringType{
+        STRUCTURAL,
+        SHEAR,
+        TYPE_COUNT
+    };
+
+    int    mass1; // Index into Masses
+    int    mass2;
+    double max_len;
+	double rest_len;
+    double spring_constant;
+    SpringType spring_type;
+    int    color; // Springs of one color share no mass
+
+
+	Spring(const Masses &masses, int m1, int m2, double k, SpringType _spring_type, int _color = 0)
+        : mass1(m1), mass2(m2), spring_constant(k), spring_type(_spring_type), color(_color) {
+
+        rest_len = glm::length(masses.position[mass2] - masses.position[mass1]);
+        max_len = rest_len * 1.1;
+	}
+};
+
+/**
+ * Flat structure-of-arrays spring table.
+ * Springs are grouped by type, then by color and, inside a color, ordered by
+ * their lower mass index, so a pass over one type walks the mass arrays front
+ * to back. Springs of type t live in [type_begin[t], type_begin[t + 1]) and
+ * springs of color c in [color_begin[c], color_begin[c + 1]). Colors must be
+ * numbered in type order, so different types never share a color.
+ */
+class Springs {
+public:
+    std::vector<int>           mass1;
+    std::vector<int>           mass2;
+    std::vector<double>        rest_len;
+    std::vector<double>        max_len;
+    std::vector<double>        spring_constant;
+    std::vector<unsigned char> spring_type;
+    int type_begin[Spring::TYPE_COUNT + 1] = {0};
+    std::vector<int>           color_begin;
+    // Springs attached to each mass, for gathering per-spring results per mass.
+    // The springs of mass i are adjacency[adjacency_begin[i] .. adjacency_begin[i + 1]),
+    // stored as s where the mass is mass1 of spring s and as ~s where it is mass2.
+    std::vector<int>           adjacency_begin;
+    std::vector<int>           adjacency;
+
+
+public:
+    int size() const { return (int)mass1.size(); }
+
+    int begin(Spring::SpringType type) const { return type_begin[type]; }
+    int end(Spring::SpringType type) const { return type_begin[type + 1]; }
+
+    int color_count() const { return (int)color_begin.size() - 1; }
+
+    double get_length(const Masses &masses, int s) const {
+        return glm::length(masses.position[mass2[s]] - masses.position[mass1[s]]);
+    }
+
+    // Sort the linked springs for locality and pack them into the table
+    void build(std::vector<Spring> springs) {
+        for (auto &spring : springs) {
+            if (spring.mass2 < spring.mass1) {
+                std::swap(spring.mass1, spring.mass2);
+            }
+        }
+        std::stable_sort(springs.begin(), springs.end(), [](const Spring &a, const Spring &b) {
+            if (a.spring_type != b.spring_type) {
+                return a.spring_type < b.spring_type;
+            }
+            if (a.color != b.color) {
+                return a.color < b.color;
+            }
+            if (a.mass1 != b.mass1) {
+                return a.mass1 < b.mass1;
+            }
+            return a.mass2 < b.mass2;
+        });
+
+        clear();
+        int n = (int)springs.size();
+        mass1.reserve(n);
+        mass2.reserve(n);
+        rest_len.reserve(n);
+        max_len.reserve(n);
+        spring_constant.reserve(n);
+        spring_type.reserve(n);
+        for (const auto &spring : springs) {
+            mass1.push_back(spring.mass1);
+            mass2.push_back(spring.mass2);
+            rest_len.push_back(spring.rest_len);
+            max_len.push_back(spring.max_len);
+            spring_constant.push_back(spring.spring_constant);
+            spring_type.push_back(spring.spring_type);
+        }
+
+        int s = 0;
+        for (int t = 0; t < Spring::TYPE_COUNT; t++) {
+            type_begin[t] = s;
+            while (s < n && spring_type[s] == t) {
+                s++;
+            }
+        }
+        type_begin[Spring::TYPE_COUNT] = n;
+
+        int colors = 0;
+        for (const auto &spring : springs) {
+            colors = std::max(colors, spring.color + 1);
+        }
+        color_begin.assign(colors + 1, 0);
+        for (const auto &spring : springs) {
+            color_begin[spring.color + 1]++;
+        }
+        for (int c = 0; c < colors; c++) {
+            color_begin[c + 1] += color_begin[c];
+        }
+    }
+
+    void build_adjacency(int mass_count) {
+        int n = size();
+        adjacency_begin.assign(mass_count + 1, 0);
+        for (int s = 0; s < n; s++) {
+            adjacency_begin[mass1[s] + 1]++;
+            adjacency_begin[mass2[s] + 1]++;
+        }
+        for (int i = 0; i < mass_count; i++) {
+            adjacency_begin[i + 1] += adjacency_begin[i];
+        }
+        adjacency.resize(n * 2);
+        std::vector<int> fill(adjacency_begin.begin(), adjacency_begin.end() - 1);
+        for (int s = 0; s < n; s++) {
+            adjacency[fill[mass1[s]]++] = s;
+            adjacency[fill[mass2[s]]++] = ~s;
+        }
+    }
+
+    void clear() {
+        mass1.clear();
+        mass2.clear();
+        rest_len.clear();
+        max_len.clear();
+        spring_constant.clear();
+        spring_type.clear();
+        color_begin.clear();
+        adjacency_begin.clear();
+        adjacency.clear();
+        std::fill(type_begin, type_begin + Spring::TYPE_COUNT + 1, 0);
+    }
+};
+
+#endif // SPRING_H
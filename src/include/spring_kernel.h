@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLOTH_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * Elastic spring forces over the flat spring table.
+ * For every spring s in [begin, end) the kernels write the force acting on
+ * mass2[s] into the SoA output (fx, fy, fz); mass1[s] receives its negation:
+ *
+ *     f = (p1 - p2) * (k * (len - rest_len) / len)
+ *
+ * The vector kernels gather the endpoint positions of 4 (AVX2) or 8 (AVX-512)
+ * springs at once and are picked at runtime, with the scalar kernel as fallback.
+ * Vector results match the scalar kernel to rounding; AVX-512 implies FMA and
+ * the compiler may fuse the length computation.
+ */
+typedef void (*SpringKernel)(const glm::dvec3 *position, const int *mass1, const int *mass2,
+                             const double *rest_len, const double *spring_constant,
+                             double *fx, double *fy, double *fz, int begin, int end);
+
+inline void spring_forces_scalar(const glm::dvec3 *position, const int *mass1, const int *mass2,
+                                 const double *rest_len, const double *spring_constant,
+                                 double *fx, double *fy, double *fz, int begin, int end)
+{
+    for (int s = begin; s < end; s++)
+    {
+        glm::dvec3 spring_vec = position[mass1[s]] - position[mass2[s]];
+        double spring_length = std::sqrt(spring_vec.x * spring_vec.x + spring_vec.y * spring_vec.y + spring_vec.z * spring_vec.z);
+        double scale = spring_constant[s] * (spring_length - rest_len[s]) / spring_length;
+        fx[s] = spring_vec.x * scale;
+        fy[s] = spring_vec.y * scale;
+        fz[s] = spring_vec.z * scale;
+    }
+}
+
+#ifdef CLOTH_SIMD_X86
+__attribute__((target("avx2"))) inline void spring_forces_avx2(const glm::dvec3 *position, const int *mass1, const int *mass2,
+                                                                const double *rest_len, const double *spring_constant,
+                                                                double *fx, double *fy, double *fz, int begin, int end)
+{
+    // glm::dvec3 is three packed doubles, so component c of mass i sits at base[3 * i + c]
+    const double *base = &position[0].x;
+    const __m128i three = _mm_set1_epi32(3);
+    // Masked gathers with an explicit zero source, every lane enabled
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    int s = begin;
+    for (; s + 4 <= end; s += 4)
+    {
+        __m128i o1 = _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(mass1 + s)), three);
+        __m128i o2 = _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)(mass2 + s)), three);
+        __m256d dx = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base, o1, all, 8), _mm256_mask_i32gather_pd(zero, base, o2, all, 8));
+        __m256d dy = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base + 1, o1, all, 8), _mm256_mask_i32gather_pd(zero, base + 1, o2, all, 8));
+        __m256d dz = _mm256_sub_pd(_mm256_mask_i32gather_pd(zero, base + 2, o1, all, 8), _mm256_mask_i32gather_pd(zero, base + 2, o2, all, 8));
+
+        __m256d len2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+        __m256d len = _mm256_sqrt_pd(len2);
+        __m256d stretch = _mm256_sub_pd(len, _mm256_loadu_pd(rest_len + s));
+        __m256d scale = _mm256_div_pd(_mm256_mul_pd(_mm256_loadu_pd(spring_constant + s), stretch), len);
+
+        _mm256_storeu_pd(fx + s, _mm256_mul_pd(dx, scale));
+        _mm256_storeu_pd(fy + s, _mm256_mul_pd(dy, scale));
+        _mm256_storeu_pd(fz + s, _mm256_mul_pd(dz, scale));
+    }
+    spring_forces_scalar(position, mass1, mass2, rest_len, spring_constant, fx, fy, fz, s, end);
+}
+
+__attribute__((target("avx512f"))) inline void spring_forces_avx512(const glm::dvec3 *position, const int *mass1, const int *mass2,
+                                                                     const double *rest_len, const double *spring_constant,
+                                                                     double *fx, double *fy, double *fz, int begin, int end)
+{
+    const double *base = &position[0].x;
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m512d zero = _mm512_setzero_pd();
+    int s = begin;
+    for (; s + 8 <= end; s += 8)
+    {
+        __m256i o1 = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(mass1 + s)), three);
+        __m256i o2 = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(mass2 + s)), three);
+        __m512d dx = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o1, base, 8), _mm512_mask_i32gather_pd(zero, 0xFF, o2, base, 8));
+        __m512d dy = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o1, base + 1, 8), _mm512_mask_i32gather_pd(zero, 0xFF, o2, base + 1, 8));
+        __m512d dz = _mm512_sub_pd(_mm512_mask_i32gather_pd(zero, 0xFF, o1, base + 2, 8), _mm512_mask_i32gather_pd(zero, 0xFF, o2, base + 2, 8));
+
+        __m512d len2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+        __m512d len = _mm512_maskz_sqrt_pd(0xFF, len2);
+        __m512d stretch = _mm512_sub_pd(len, _mm512_loadu_pd(rest_len + s));
+        __m512d scale = _mm512_div_pd(_mm512_mul_pd(_mm512_loadu_pd(spring_constant + s), stretch), len);
+
+        _mm512_storeu_pd(fx + s, _mm512_mul_pd(dx, scale));
+        _mm512_storeu_pd(fy + s, _mm512_mul_pd(dy, scale));
+        _mm512_storeu_pd(fz + s, _mm512_mul_pd(dz, scale));
+    }
+    spring_forces_scalar(position, mass1, mass2, rest_len, spring_constant, fx, fy, fz, s, end);
+}
+#endif
+
+inline bool spring_kernel_supported(const char *name)
+{
+    if (!strcmp(name, "scalar"))
+    {
+        return true;
+    }
+#ifdef CLOTH_SIMD_X86
+    __builtin_cpu_init();
+    if (!strcmp(name, "avx2"))
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (!strcmp(name, "avx512"))
+    {
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    return false;
+}
+
+inline SpringKernel spring_kernel_by_name(const char *name)
+{
+    if (!spring_kernel_supported(name))
+    {
+        return nullptr;
+    }
+#ifdef CLOTH_SIMD_X86
+    if (!strcmp(name, "avx2"))
+    {
+        return spring_forces_avx2;
+    }
+    if (!strcmp(name, "avx512"))
+    {
+        return spring_forces_avx512;
+    }
+#endif
+    return spring_forces_scalar;
+}
+
+// Name of the widest kernel this CPU runs, the CLOTH_SIMD environment variable overrides it
+inline const char *best_spring_kernel()
+{
+    const char *forced = getenv("CLOTH_SIMD");
+    if (forced != nullptr && spring_kernel_supported(forced))
+    {
+        return forced;
+    }
+    if (spring_kernel_supported("avx512"))
+    {
+        return "avx512";
+    }
+    if (spring_kernel_supported("avx2"))
+    {
+        return "avx2";
+    }
+    return "scalar";
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "trace.h"
+
+/**
+ * Persistent pool of worker threads for data-parallel loops.
+ * Workers are started once and sleep between jobs, so a simulation step can
+ * hand out several parallel loops without spawning threads. The calling thread
+ * works on the loop too and parallel_for only returns once every chunk is done.
+ */
+class ThreadPool
+{
+public:
+    // thread_count includes the calling thread, 0 means one per hardware thread
+    ThreadPool(int thread_count = 0)
+    {
+        if (thread_count <= 0)
+        {
+            thread_count = std::max(1, (int)std::thread::hardware_concurrency());
+        }
+        for (int i = 1; i < thread_count; i++)
+        {
+            workers.emplace_back([this]() { worker_loop(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const { return (int)workers.size() + 1; }
+
+    /**
+     * Call fn(chunk_begin, chunk_end) over [begin, end) split into chunks of at
+     * least grain items. Ranges no larger than grain run inline on the caller.
+     * Not reentrant: fn must not call parallel_for on the same pool.
+     */
+    template <class Function>
+    void parallel_for(int begin, int end, int grain, Function &&fn)
+    {
+        int count = end - begin;
+        if (count <= 0)
+        {
+            return;
+        }
+        if (workers.empty() || count <= grain)
+        {
+            fn(begin, end);
+            return;
+        }
+
+        // A few chunks per thread so uneven chunks still balance out
+        int chunk = std::max(grain, (count + size() * 4 - 1) / (size() * 4));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job_invoke = [](void *context, int b, int e) { (*static_cast<typename std::remove_reference<Function>::type *>(context))(b, e); };
+            job_context = (void *)&fn;
+            job_begin = begin;
+            job_end = end;
+            job_chunk = chunk;
+            job_chunk_count = (count + chunk - 1) / chunk;
+            next_chunk.store(0, std::memory_order_relaxed);
+            done_chunks.store(0, std::memory_order_relaxed);
+            job_open = true;
+            generation++;
+        }
+        wake.notify_all();
+
+        run_chunks();
+        while (done_chunks.load(std::memory_order_acquire) < job_chunk_count)
+        {
+            std::this_thread::yield();
+        }
+
+        // Close the job and wait for late workers to leave it before fn goes out of scope
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job_open = false;
+        }
+        while (active_workers.load(std::memory_order_acquire) > 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;
+    bool job_open = false;
+    unsigned long generation = 0;
+
+    void (*job_invoke)(void *, int, int) = nullptr;
+    void *job_context = nullptr;
+    int job_begin = 0;
+    int job_end = 0;
+    int job_chunk = 0;
+    int job_chunk_count = 0;
+    std::atomic<int> next_chunk{0};
+    std::atomic<int> done_chunks{0};
+    std::atomic<int> active_workers{0};
+
+    void run_chunks()
+    {
+        while (true)
+        {
+            int c = next_chunk.fetch_add(1, std::memory_order_relaxed);
+            if (c >= job_chunk_count)
+            {
+                return;
+            }
+            int b = job_begin + c * job_chunk;
+            int e = std::min(job_end, b + job_chunk);
+            TraceScope scope("parallel_for chunk", "pool");
+            job_invoke(job_context, b, e);
+            done_chunks.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    void worker_loop()
+    {
+        unsigned long seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stop || (job_open && generation != seen); });
+                if (stop)
+                {
+                    return;
+                }
+                seen = generation;
+                active_workers.fetch_add(1, std::memory_order_relaxed);
+            }
+            run_chunks();
+            active_workers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+};
+
+// pool->parallel_for, or a plain call on the calling thread without a pool
+template <class Function>
+inline void parallel_for(ThreadPool *pool, int begin, int end, int grain, Function &&fn)
+{
+    if (pool == nullptr)
+    {
+        if (begin < end)
+        {
+            fn(begin, end);
+        }
+        return;
+    }
+    pool->parallel_for(begin, end, grain, fn);
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Checked by every trace scope, so a disabled recorder costs one relaxed load
+inline std::atomic<bool> trace_active{false};
+
+inline bool trace_enabled()
+{
+    return trace_active.load(std::memory_order_relaxed);
+}
+
+struct TraceEvent
+{
+    const char *name;     // Must outlive the recorder, string literals in practice
+    const char *category;
+    int64_t begin_ns;     // Since the recorder was created
+    int64_t duration_ns;
+};
+
+/**
+ * Ring buffer of the events of one thread. Only its thread writes to it, so
+ * recording takes no lock; once full the oldest events are overwritten.
+ */
+class TraceBuffer
+{
+public:
+    const int thread_id;
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> written{0};
+
+    TraceBuffer(int _thread_id, int capacity)
+        : thread_id(_thread_id), events(capacity) {}
+
+    void push(const TraceEvent &event)
+    {
+        uint64_t w = written.load(std::memory_order_relaxed);
+        events[w % events.size()] = event;
+        written.store(w + 1, std::memory_order_release);
+    }
+};
+
+/**
+ * Process-wide timeline recorder that writes Chrome trace event JSON, which
+ * chrome://tracing and ui.perfetto.dev open directly. A thread gets its own
+ * buffer the first time it records; that registration is the only locked
+ * operation. write_json must run after stop, while no thread records.
+ */
+class Tracer
+{
+public:
+    static Tracer &instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // Clears what was recorded and starts recording into rings of events_per_thread, call while stopped
+    void start(int events_per_thread = 1 << 16)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = events_per_thread;
+        for (auto &buffer : buffers)
+        {
+            buffer->events.resize(events_per_thread);
+            buffer->written.store(0, std::memory_order_relaxed);
+        }
+        trace_active.store(true, std::memory_order_release);
+    }
+
+    void stop()
+    {
+        trace_active.store(false, std::memory_order_release);
+    }
+
+    void record(const char *name, const char *category,
+                std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+    {
+        thread_local TraceBuffer *buffer = nullptr;
+        if (buffer == nullptr)
+        {
+            buffer = register_thread();
+        }
+        buffer->push({name, category,
+                      std::chrono::duration_cast<std::chrono::nanoseconds>(begin - origin).count(),
+                      std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()});
+    }
+
+    bool write_json(const char *path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(path);
+        if (!out)
+        {
+            return false;
+        }
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        char line[512];
+        for (const auto &buffer : buffers)
+        {
+            snprintf(line, sizeof(line), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                     first ? "" : ",", buffer->thread_id, buffer->thread_id);
+            out << line;
+            first = false;
+
+            uint64_t written = buffer->written.load(std::memory_order_acquire);
+            uint64_t size = buffer->events.size();
+            for (uint64_t e = written > size ? written - size : 0; e < written; e++)
+            {
+                const TraceEvent &event = buffer->events[e % size];
+                snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                         event.name, event.category, event.begin_ns * 1e-3, event.duration_ns * 1e-3, buffer->thread_id);
+                out << line;
+            }
+        }
+        out << "\n]}\n";
+        return (bool)out;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers; // Kept until exit, threads hold raw pointers
+    int capacity = 1 << 16;
+    const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    Tracer() {}
+
+    TraceBuffer *register_thread()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.emplace_back(new TraceBuffer((int)buffers.size(), capacity));
+        return buffers.back().get();
+    }
+};
+
+// Records the lifetime of the scope as one complete event while tracing is on
+class TraceScope
+{
+public:
+    TraceScope(const char *_name, const char *_category = "sim")
+        : name(_name), category(_category), active(trace_enabled())
+    {
+        if (active)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (active)
+        {
+            Tracer::instance().record(name, category, start, std::chrono::steady_clock::now());
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
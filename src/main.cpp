@@ -13,12 +13,12 @@
 #include "include/rigid.h"
 #include "include/program.h"
 #include "include/render.h"
+#include "include/sim_thread.h"
 #include <thread>
 
 #define WIDTH 800
 #define HEIGHT 800
 #define AIR_FRICTION 0.02
-#define TIME_STEP 0.01
 #define WINDBLOWINGRADIUS 100
 
 using namespace std;
@@ -36,19 +36,29 @@ glm::dvec3 windStartPos;
 glm::dvec3 windDir;
 glm::dvec3 wind;
 Cloth cloth;
+ThreadPool pool;
+Profiler profiler;
+// Steps the cloth, the GUI thread only sends it input and draws its frames
+SimulationThread simulation(cloth);
 // show constraint
 bool constraint = true;
+bool selfCollision = false;
+bool sleeping = false;
 
 // Ball&Cube&rectangle
 Ball ball;
 Cube cube;
 Rectangle rectangle;
 RigidType currentRigidType = RigidType::Empty; // Default to Emptu
+// One scene per rigid body, the simulation thread reads the one it was last sent
+ColliderScene ballScene;
+ColliderScene cubeScene;
+ColliderScene rectScene;
 // Boolean show ball or cube
 bool showBall = false;
 bool showCube = false;
 bool showRect = false;
-void *obj;
+void post_collider();
 
 // Window and world
 GLFWwindow *window;
@@ -58,6 +68,17 @@ int main(int argc, const char *argv[])
 {
     string method = argc > 1 ? argv[1] : "Euler"; // default method is Euler
     cout << method << endl;
+    cloth.set_thread_pool(&pool);
+    cloth.set_profiler(&profiler);
+    ballScene.add(make_collider(ball));
+    cubeScene.add(make_collider(cube));
+    rectScene.add(make_collider(rectangle));
+    // CLOTH_TRACE=trace.json records a timeline of the run, written on exit
+    const char *trace_path = getenv("CLOTH_TRACE");
+    if (trace_path != nullptr)
+    {
+        Tracer::instance().start();
+    }
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -105,63 +126,40 @@ int main(int argc, const char *argv[])
     glEnable(GL_DEPTH_TEST);
     glPointSize(3);
 
+    simulation.profiler = &profiler;
+    if (!simulation.start(method))
+    {
+        glfwTerminate();
+        return -1;
+    }
+
     /** Redering loop **/
     int count = 0;
     auto start = std::chrono::high_resolution_clock::now();
     while (!glfwWindowShouldClose(window)) {
+        TraceScope frame_trace("frame", "frame");
         /** Set background clolor **/
         glClearColor(bgColor.x, bgColor.y, bgColor.z, 1.0); // Set color value (R,G,B,A) - Set Status
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         /** -------------------------------- Simulation & Rendering -------------------------------- **/
-        if (currentRigidType == RigidType::Ball)
-        {
-            obj = static_cast<void *>(&ball);
-        }
-        else if (currentRigidType == RigidType::Cube)
-        {
-            obj = static_cast<void *>(&cube);
-        }
-        else if (currentRigidType == RigidType::Rectangle)
-        {
-            obj = static_cast<void *>(&rectangle);
-        }
-        else
-        {
-            obj = nullptr;
-        }
-
-        for (int i = 0; i < 25; i++)
-        {
-            if (method == "RK")
-            {
-                cloth.rk4_step(constraint, currentRigidType, obj, TIME_STEP);
-            }
-            else if (method == "VERLET")
-            {
-                cloth.explicit_verlet(constraint, currentRigidType, obj, TIME_STEP);
-            }
-            else
-            {
-                cloth.step(constraint, currentRigidType, obj, TIME_STEP);
-            }
-        }
+        // The simulation thread steps on its own, draw the latest frame it finished
+        const ClothFrame &frame = simulation.latest();
         count++;
         if (count == 100) {
             auto end = std::chrono::high_resolution_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
             std::cout << duration.count() << std::endl;
         }
-        cloth.compute_normal();
 
         /** Display **/
         if (cloth.draw_texture)
         {
-            clothRender.flush();
+            clothRender.flush(frame.position.data(), frame.normal.data());
         }
         else
         {
-            clothSpringRender.flush();
+            clothSpringRender.flush(frame.position.data(), frame.normal.data());
         }
         // control ball & cube rendering
         if (showCube)
@@ -185,7 +183,17 @@ int main(int argc, const char *argv[])
         glfwPollEvents(); // Update the status of window
     }
 
+    simulation.stop();
     glfwTerminate();
+    profiler.report(cout);
+    if (trace_path != nullptr)
+    {
+        Tracer::instance().stop();
+        if (!Tracer::instance().write_json(trace_path))
+        {
+            cout << "ERROR::main : Failed to write " << trace_path << endl;
+        }
+    }
 
     return 0;
 }
@@ -212,20 +220,6 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
     }
 }
 
-// Method to calculate wind force decay factor
-double calculateWindDecay(float distance, float radius)
-{
-    // Ensure the distance is within the range [0, radius]
-    if (distance >= radius)
-        return 0.0f;
-    if (distance <= 0.0f)
-        return 1.0f;
-
-    // Use cosine function to calculate the decay factor
-    double decayFactor = cos(distance / radius);
-    return decayFactor;
-}
-
 void cursor_pos_callback(GLFWwindow *window, double xpos, double ypos)
 {
 
@@ -240,40 +234,35 @@ void cursor_pos_callback(GLFWwindow *window, double xpos, double ypos)
     windDir = glm::normalize(windDir);
     wind = windDir * windForceScale;
 
-    glm::dvec3 clothPos = cloth.cloth_pos;
-    glm::dvec2 mousePosition = glm::dvec2(xpos, ypos);
-
-    glm::mat4 viewMatrix = cam.uniViewMatrix;
-    glm::mat4 projectionMatrix = cam.uniProjMatrix;
+    // The simulation thread finds the masses near the cursor and pushes them
+    ClothInput input;
+    input.kind = ClothInput::Wind;
+    input.view_projection = cam.uniProjMatrix * cam.uniViewMatrix;
+    input.mouse = glm::dvec2(xpos, ypos);
+    input.screen = glm::dvec2(WIDTH, HEIGHT);
+    input.force = wind;
+    input.radius = WINDBLOWINGRADIUS;
+    simulation.post(input);
+}
 
-    for (int i = 0; i < cloth.masses.size(); i++)
+// Tell the simulation thread which scene the cloth collides with
+void post_collider()
+{
+    ClothInput input;
+    input.kind = ClothInput::Collider;
+    if (currentRigidType == RigidType::Ball)
     {
-        glm::dvec3 massLocalPosition = cloth.masses[i]->last_position;
-
-        // Transform the mass to world coordinates
-        glm::dvec3 massPosition = glm::dvec3(clothPos.x + massLocalPosition.x,
-                                             clothPos.y + massLocalPosition.y,
-                                             clothPos.z + massLocalPosition.z);
-
-       // Transform the mass's world coordinates to screen space via clip space and NDC space
-        glm::vec4 clipSpacePos = projectionMatrix * viewMatrix * glm::vec4(massPosition, 1.0);
-        glm::vec3 ndcSpacePos = glm::vec3(clipSpacePos) / clipSpacePos.w;
-
-        glm::dvec2 screenPos = glm::dvec2((ndcSpacePos.x + 1.0) / 2.0 * WIDTH,
-                                          (1.0 - ndcSpacePos.y) / 2.0 * HEIGHT);
-
-        // Calculate the distance between the mass and the mouse position
-        glm::dvec2 massToMouse = screenPos - mousePosition;
-
-        double distance = glm::length(massToMouse);
-
-        // Check if the distance is within the half radius of wind blowing, if so, increase the force on the corresponding mass
-        if (distance <= WINDBLOWINGRADIUS)
-        {
-            double decay = calculateWindDecay(distance, WINDBLOWINGRADIUS);
-            cloth.masses[i]->force += wind * decay;
-        }
+        input.scene = &ballScene;
     }
+    else if (currentRigidType == RigidType::Cube)
+    {
+        input.scene = &cubeScene;
+    }
+    else if (currentRigidType == RigidType::Rectangle)
+    {
+        input.scene = &rectScene;
+    }
+    simulation.post(input);
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
@@ -282,7 +271,9 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     if (key == GLFW_KEY_R && action == GLFW_PRESS)
     {
 
-        cloth.reset();
+        ClothInput input;
+        input.kind = ClothInput::Reset;
+        simulation.post(input);
         cout << "----------Simulation reset-----------" << endl;
     }
 
@@ -308,6 +299,7 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
             currentRigidType = RigidType::Cube;
             cout << "----------Show Cube-----------" << endl;
         }
+        post_collider();
     }
     // show rectangle when press E
     if (key == GLFW_KEY_E && action == GLFW_PRESS)
@@ -325,6 +317,7 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
             currentRigidType = RigidType::Rectangle;
             cout << "----------Show Rectangle-----------" << endl;
         }
+        post_collider();
     }
 
     // show ball when press B
@@ -343,15 +336,50 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
             currentRigidType = RigidType::Ball;
             cout << "----------Show Ball-----------" << endl;
         }
+        post_collider();
     }
 
     // add constraint when press A
     if (key == GLFW_KEY_A && action == GLFW_PRESS)
     {
         constraint = (1 - constraint);
+        ClothInput input;
+        input.kind = ClothInput::Constraint;
+        input.enabled = constraint;
+        simulation.post(input);
         cout << "----------Add constraint-----------" << endl;
     }
 
+    // toggle self-collision when press S
+    if (key == GLFW_KEY_S && action == GLFW_PRESS)
+    {
+        selfCollision = !selfCollision;
+        ClothInput input;
+        input.kind = ClothInput::SelfCollision;
+        input.enabled = selfCollision;
+        simulation.post(input);
+        cout << "----------Self-collision " << (selfCollision ? "on" : "off") << "-----------" << endl;
+    }
+
+    // toggle sleeping of still tiles when press Z
+    if (key == GLFW_KEY_Z && action == GLFW_PRESS)
+    {
+        sleeping = !sleeping;
+        ClothInput input;
+        input.kind = ClothInput::Sleeping;
+        input.enabled = sleeping;
+        simulation.post(input);
+        cout << "----------Sleeping " << (sleeping ? "on" : "off") << "-----------" << endl;
+    }
+
+    // print the step profile when press P
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+    {
+        ClothInput input;
+        input.kind = ClothInput::ReportProfile;
+        simulation.post(input);
+    }
+
     // close windoow when press Esc
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     {